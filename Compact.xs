@@ -0,0 +1,705 @@
+#include "EXTERN.h"
+#include "perl.h"
+#include "XSUB.h"
+
+#include "ppport.h"
+
+#include "handle.h"
+#include "Compact.h"
+
+static void ac_close_perlio(pTHX_ void *fp)
+{
+    PerlIO_close((PerlIO *) fp);
+}
+
+/* HashView objects are blessed arrays of [node, iterator position] */
+static SV **ac_view_slots(pTHX_ SV *self)
+{
+    if (!SvROK(self) || SvTYPE(SvRV(self)) != SVt_PVAV ||
+            AvFILLp((AV *) SvRV(self)) != 1)
+        croak("Not an Arena::Compact::HashView");
+
+    return AvARRAY((AV *) SvRV(self));
+}
+
+/* The key for a name, created if need be */
+static struct ac_key *ac_view_key(pTHX_ ac_object o, SV *name)
+{
+    struct ac_key *k = ac_node_key_named(aTHX_ o, name);
+
+    return k ? k : ac_key_intern(aTHX_ name);
+}
+
+static SV *ac_view_next(pTHX_ SV *self)
+{
+    SV **slots = ac_view_slots(aTHX_ self);
+    UV pos = SvUV(slots[1]);
+    struct ac_key *k = ac_node_next_key(aTHX_
+            ac_node_unhandle(aTHX_ slots[0], NULL), &pos);
+
+    sv_setuv(slots[1], pos);
+    return k ? newSVsv(k->name) : &PL_sv_undef;
+}
+
+MODULE = Arena::Compact		PACKAGE = Arena::Compact
+
+PROTOTYPES: DISABLE
+
+void
+profile(on)
+        int on
+    CODE:
+        ac_param_profile = on;
+
+SV *
+profile_dump()
+    CODE:
+        RETVAL = ac_profile_dump(aTHX);
+    OUTPUT:
+        RETVAL
+
+void
+profile_reset()
+    CODE:
+        ac_profile_reset();
+
+void
+hint(key, ...)
+        SV *key
+    PREINIT:
+        struct ac_key *k;
+        const char *opt;
+        int i;
+    CODE:
+        k = ac_key_unhandle(aTHX_ key);
+        if (!(items & 1))
+            croak("Usage: Arena::Compact::hint(key, option => value, ...)");
+        for (i = 1; i < items; i += 2)
+        {
+            opt = SvPV_nolen(ST(i));
+            if (strEQ(opt, "cold"))
+                k->layout_flags = SvTRUE(ST(i + 1)) ?
+                    k->layout_flags | AC_FIELD_COLD :
+                    k->layout_flags & ~AC_FIELD_COLD;
+            else if (strEQ(opt, "weight"))
+                k->weight = SvUV(ST(i + 1));
+            else
+                croak("Bad option %s to hint", opt);
+        }
+
+SV *
+layout_hints(class)
+        SV *class
+    CODE:
+        RETVAL = ac_profile_hints_dump(aTHX_ ac_class_unhandle(aTHX_ class));
+    OUTPUT:
+        RETVAL
+
+SV *
+layout(class)
+        SV *class
+    CODE:
+        RETVAL = ac_layout_dump(aTHX_ ac_class_unhandle(aTHX_ class));
+    OUTPUT:
+        RETVAL
+
+void
+lazy_bless(on)
+        int on
+    CODE:
+        if (on)
+            ac_install_lazy_ops(aTHX);
+        ac_param_lazy_bless = on;
+
+void
+destroy_batch(size)
+        int size
+    CODE:
+        ac_param_destroy_batch = size;
+        if (size <= 0)
+            ac_flush_destroys();
+
+void
+flush()
+    CODE:
+        ac_flush_destroys();
+
+void
+_install_ops()
+    CODE:
+        ac_install_ops(aTHX);
+
+#ifdef AC_TEST_HOOKS
+
+SV *
+_canon_handle(n)
+        UV n
+    CODE:
+        RETVAL = newRV_noinc(ac_canon_test_handle(aTHX_ n));
+    OUTPUT:
+        RETVAL
+
+UV
+_canon_value(ref)
+        SV *ref
+    CODE:
+        if (!SvROK(ref))
+            croak("not a test handle");
+        RETVAL = ac_canon_test_value(aTHX_ SvRV(ref));
+    OUTPUT:
+        RETVAL
+
+void
+_canon_rehome(ref, n)
+        SV *ref
+        UV n
+    CODE:
+        if (!SvROK(ref))
+            croak("not a test handle");
+        ac_canon_test_rehome(aTHX_ SvRV(ref), n);
+
+void
+_canon_stats()
+    PREINIT:
+        UV used, size;
+        int resizing;
+    PPCODE:
+        ac_canon_test_stats(&used, &size, &resizing);
+        EXTEND(SP, 3);
+        mPUSHu(used);
+        mPUSHu(size);
+        mPUSHi(resizing);
+
+#endif
+
+SV *
+new()
+    CODE:
+        RETVAL = ac_node_new(aTHX);
+    OUTPUT:
+        RETVAL
+
+SV *
+key(name, ...)
+        SV *name
+    CODE:
+        if (items > 2)
+            croak("Usage: Arena::Compact::key(name[, type])");
+        RETVAL = ac_key(aTHX_ name, items > 1 && SvOK(ST(1)) ?
+                ac_make_type_named(aTHX_ SvPV_nolen(ST(1))) : NULL);
+    OUTPUT:
+        RETVAL
+
+SV *
+template(...)
+    PREINIT:
+        struct ac_key **keys;
+        int i;
+    CODE:
+        Newx(keys, items + 1, struct ac_key *);
+        SAVEFREEPV(keys);
+        for (i = 0; i < items; i++)
+            keys[i] = ac_key_unhandle(aTHX_ ST(i));
+        RETVAL = ac_template_new(aTHX_ keys, items);
+    OUTPUT:
+        RETVAL
+
+SV *
+new_from_template(tpl, ...)
+        SV *tpl
+    CODE:
+        RETVAL = ac_node_new_from_template(aTHX_ ac_template_unhandle(aTHX_ tpl),
+                &ST(1), items - 1);
+    OUTPUT:
+        RETVAL
+
+SV *
+accessor(key, like)
+        SV *key
+        SV *like
+    PREINIT:
+        struct ac_key *k;
+        struct ac_class *cl;
+    CODE:
+        k = ac_key_unhandle(aTHX_ key);
+        if (SvROK(like) && ac_unhandle(aTHX_ &ac_hs_template, SvRV(like),
+                    NULL, NULL))
+            cl = ac_template_unhandle(aTHX_ like)->cl;
+        else
+            cl = ac_class_of(ac_node_unhandle(aTHX_ like, NULL));
+        RETVAL = ac_accessor_new(aTHX_ k, cl);
+    OUTPUT:
+        RETVAL
+
+SV *
+import_records(recs, schema = &PL_sv_undef)
+        SV *recs
+        SV *schema
+    CODE:
+        if (!SvROK(recs) || SvTYPE(SvRV(recs)) != SVt_PVAV)
+            croak("Usage: Arena::Compact::import_records(\\@hashes"
+                    "[, template])");
+        RETVAL = ac_node_import(aTHX_ (AV *) SvRV(recs),
+                SvOK(schema) ? ac_template_unhandle(aTHX_ schema) : NULL);
+    OUTPUT:
+        RETVAL
+
+SV *
+inflate(node)
+        SV *node
+    CODE:
+        RETVAL = ac_node_inflate(aTHX_ ac_node_unhandle(aTHX_ node, NULL));
+    OUTPUT:
+        RETVAL
+
+SV *
+inflate_many(nodes)
+        SV *nodes
+    PREINIT:
+        AV *in, *out;
+        SSize_t i, n;
+        SV **svp;
+    CODE:
+        if (!SvROK(nodes) || SvTYPE(SvRV(nodes)) != SVt_PVAV)
+            croak("Usage: Arena::Compact::inflate_many(\\@nodes)");
+        in = (AV *) SvRV(nodes);
+        out = (AV *) sv_2mortal((SV *) newAV());
+        n = av_len(in) + 1;
+        if (n)
+            av_extend(out, n - 1);
+        for (i = 0; i < n; i++)
+        {
+            svp = av_fetch(in, i, 0);
+            av_store(out, i, ac_node_inflate(aTHX_
+                    ac_node_unhandle(aTHX_ svp ? *svp : &PL_sv_undef, NULL)));
+        }
+        RETVAL = newRV_inc((SV *) out);
+    OUTPUT:
+        RETVAL
+
+SV *
+load_delimited(file, tpl, ...)
+        SV *file
+        SV *tpl
+    PREINIT:
+        struct ac_template *t;
+        PerlIO *fp;
+        int i, sep = ',', quote = '"', header = 0;
+        STRLEN len;
+        const char *opt, *pv;
+    CODE:
+        t = ac_template_unhandle(aTHX_ tpl);
+        if (items & 1)
+            croak("Usage: Arena::Compact::load_delimited(file, template, "
+                    "option => value, ...)");
+        for (i = 2; i < items; i += 2)
+        {
+            opt = SvPV_nolen(ST(i));
+            pv = SvOK(ST(i + 1)) ? SvPV(ST(i + 1), len) : (len = 0, "");
+            if (strEQ(opt, "sep") && len == 1)
+                sep = (U8) *pv;
+            else if (strEQ(opt, "quote") && len <= 1)
+                quote = len ? (U8) *pv : -1;
+            else if (strEQ(opt, "header"))
+                header = SvTRUE(ST(i + 1));
+            else
+                croak("Bad option %s to load_delimited", opt);
+        }
+        if (SvROK(file) || isGV_with_GP(file))
+        {
+            fp = IoIFP(sv_2io(file));
+        }
+        else
+        {
+            if (!(fp = PerlIO_open(SvPV_nolen(file), "rb")))
+                croak("Cannot open %s: %s", SvPV_nolen(file), Strerror(errno));
+            SAVEDESTRUCTOR_X(ac_close_perlio, fp);
+        }
+        RETVAL = ac_load_delimited(aTHX_ fp, t, sep, quote, header);
+    OUTPUT:
+        RETVAL
+
+SV *
+get(node, key)
+        SV *node
+        SV *key
+    PREINIT:
+        ac_object o;
+        struct ac_key *k;
+    CODE:
+        o = ac_node_unhandle(aTHX_ node, NULL);
+        k = ac_key_unhandle(aTHX_ key);
+        RETVAL = newSV(0);
+        ac_node_get(aTHX_ o, k, RETVAL);
+    OUTPUT:
+        RETVAL
+
+void
+put(node, key, value)
+        SV *node
+        SV *key
+        SV *value
+    PREINIT:
+        SV *handle;
+        struct ac_key *k;
+    CODE:
+        ac_node_unhandle(aTHX_ node, &handle);
+        k = ac_key_unhandle(aTHX_ key);
+        ac_node_put(aTHX_ handle, k, value);
+
+void
+put_many(node, ...)
+        SV *node
+    PREINIT:
+        SV *handle;
+        struct ac_key **keys;
+        SV **vals;
+        int i, count;
+    CODE:
+        if (!(items & 1))
+            croak("Usage: Arena::Compact::put_many(node, key => value, ...)");
+        ac_node_unhandle(aTHX_ node, &handle);
+        count = (items - 1) / 2;
+        Newx(keys, count + 1, struct ac_key *);
+        SAVEFREEPV(keys);
+        Newx(vals, count + 1, SV *);
+        SAVEFREEPV(vals);
+        for (i = 0; i < count; i++)
+        {
+            keys[i] = ac_key_unhandle(aTHX_ ST(1 + 2 * i));
+            vals[i] = ST(2 + 2 * i);
+        }
+        ac_node_put_many(aTHX_ handle, keys, vals, count);
+
+int
+exists(node, key)
+        SV *node
+        SV *key
+    PREINIT:
+        ac_object o;
+        struct ac_key *k;
+    CODE:
+        o = ac_node_unhandle(aTHX_ node, NULL);
+        k = ac_key_unhandle(aTHX_ key);
+        RETVAL = ac_node_exists(aTHX_ o, k);
+    OUTPUT:
+        RETVAL
+
+void
+delete(node, key)
+        SV *node
+        SV *key
+    PREINIT:
+        ac_object o;
+        struct ac_key *k;
+    CODE:
+        o = ac_node_unhandle(aTHX_ node, NULL);
+        k = ac_key_unhandle(aTHX_ key);
+        ac_node_delete(aTHX_ o, k);
+
+SV *
+class_of(node)
+        SV *node
+    CODE:
+        RETVAL = newRV_inc(ac_class_of(ac_node_unhandle(aTHX_ node,
+                        NULL))->reflection);
+    OUTPUT:
+        RETVAL
+
+void
+check_ids(on)
+        int on
+    CODE:
+        ac_param_check_ids = on;
+
+UV
+new_id(tpl=&PL_sv_undef)
+        SV *tpl
+    CODE:
+        RETVAL = ac_id_new(aTHX_
+                SvOK(tpl) ? ac_template_unhandle(aTHX_ tpl) : NULL);
+    OUTPUT:
+        RETVAL
+
+SV *
+get_id(id, key)
+        UV id
+        SV *key
+    PREINIT:
+        ac_object o;
+        struct ac_key *k;
+    CODE:
+        o = ac_id_check(aTHX_ id);
+        k = ac_key_unhandle(aTHX_ key);
+        RETVAL = newSV(0);
+        ac_node_get(aTHX_ o, k, RETVAL);
+    OUTPUT:
+        RETVAL
+
+UV
+put_id(id, key, value)
+        UV id
+        SV *key
+        SV *value
+    CODE:
+        RETVAL = ac_id_put(aTHX_ id, ac_key_unhandle(aTHX_ key), value);
+    OUTPUT:
+        RETVAL
+
+int
+exists_id(id, key)
+        UV id
+        SV *key
+    PREINIT:
+        ac_object o;
+    CODE:
+        o = ac_id_check(aTHX_ id);
+        RETVAL = ac_node_exists(aTHX_ o, ac_key_unhandle(aTHX_ key));
+    OUTPUT:
+        RETVAL
+
+void
+delete_id(id, key)
+        UV id
+        SV *key
+    PREINIT:
+        ac_object o;
+    CODE:
+        o = ac_id_check(aTHX_ id);
+        ac_node_delete(aTHX_ o, ac_key_unhandle(aTHX_ key));
+
+void
+ref_id(id)
+        UV id
+    CODE:
+        ac_id_ref(aTHX_ id);
+
+void
+unref_id(id)
+        UV id
+    CODE:
+        ac_id_unref(aTHX_ id);
+
+MODULE = Arena::Compact		PACKAGE = Arena::Compact::IdArray
+
+SV *
+new(class, ...)
+        const char *class
+    PREINIT:
+        SV *ref;
+        struct ac_id_array *a;
+        int i;
+    CODE:
+        ref = sv_2mortal(ac_id_array_new(aTHX_ gv_stashpv(class, GV_ADD)));
+        a = ac_id_array_unhandle(aTHX_ ref);
+        for (i = 1; i < items; i++)
+            ac_id_array_push(aTHX_ a, SvUV(ST(i)));
+        RETVAL = SvREFCNT_inc(ref);
+    OUTPUT:
+        RETVAL
+
+void
+push(self, ...)
+        SV *self
+    PREINIT:
+        struct ac_id_array *a;
+        int i;
+    CODE:
+        a = ac_id_array_unhandle(aTHX_ self);
+        for (i = 1; i < items; i++)
+            ac_id_array_push(aTHX_ a, SvUV(ST(i)));
+
+SV *
+pop(self)
+        SV *self
+    PREINIT:
+        struct ac_id_array *a;
+    CODE:
+        a = ac_id_array_unhandle(aTHX_ self);
+        RETVAL = a->count ? newSVuv(ac_id_array_pop(aTHX_ a)) : newSV(0);
+    OUTPUT:
+        RETVAL
+
+void
+clear(self)
+        SV *self
+    CODE:
+        ac_id_array_clear(aTHX_ ac_id_array_unhandle(aTHX_ self));
+
+SV *
+get(self, index)
+        SV *self
+        IV index
+    PREINIT:
+        struct ac_id_array *a;
+    CODE:
+        a = ac_id_array_unhandle(aTHX_ self);
+        if (index < 0)
+            index += a->count;
+        RETVAL = index >= 0 && (UV) index < a->count ?
+            newSVuv(a->ids[index]) : newSV(0);
+    OUTPUT:
+        RETVAL
+
+UV
+len(self)
+        SV *self
+    CODE:
+        RETVAL = ac_id_array_unhandle(aTHX_ self)->count;
+    OUTPUT:
+        RETVAL
+
+void
+ids(self)
+        SV *self
+    PREINIT:
+        struct ac_id_array *a;
+        UV i;
+    PPCODE:
+        a = ac_id_array_unhandle(aTHX_ self);
+        EXTEND(SP, (SSize_t) a->count);
+        for (i = 0; i < a->count; i++)
+            mPUSHu(a->ids[i]);
+
+void
+sort(self)
+        SV *self
+    CODE:
+        ac_id_array_sort(ac_id_array_unhandle(aTHX_ self));
+
+void
+unique(self)
+        SV *self
+    CODE:
+        ac_id_array_unique(aTHX_ ac_id_array_unhandle(aTHX_ self));
+
+SV *
+intersect(self, other)
+        SV *self
+        SV *other
+    CODE:
+        RETVAL = ac_id_array_intersect(aTHX_ self,
+                ac_id_array_unhandle(aTHX_ other));
+    OUTPUT:
+        RETVAL
+
+MODULE = Arena::Compact		PACKAGE = Arena::Compact::HashView
+
+SV *
+TIEHASH(class, node)
+        const char *class
+        SV *node
+    PREINIT:
+        AV *self;
+    CODE:
+        ac_node_unhandle(aTHX_ node, NULL);
+        self = newAV();
+        av_push(self, newSVsv(node));
+        av_push(self, newSVuv(0));
+        RETVAL = sv_bless(newRV_noinc((SV *) self), gv_stashpv(class, GV_ADD));
+    OUTPUT:
+        RETVAL
+
+SV *
+FETCH(self, name)
+        SV *self
+        SV *name
+    PREINIT:
+        ac_object o;
+        struct ac_key *k;
+    CODE:
+        o = ac_node_unhandle(aTHX_ ac_view_slots(aTHX_ self)[0], NULL);
+        k = ac_node_key_named(aTHX_ o, name);
+        RETVAL = newSV(0);
+        if (k && ac_node_exists(aTHX_ o, k))
+            ac_node_get(aTHX_ o, k, RETVAL);
+    OUTPUT:
+        RETVAL
+
+void
+STORE(self, name, value)
+        SV *self
+        SV *name
+        SV *value
+    PREINIT:
+        SV *handle;
+        ac_object o;
+    CODE:
+        o = ac_node_unhandle(aTHX_ ac_view_slots(aTHX_ self)[0], &handle);
+        ac_node_put(aTHX_ handle, ac_view_key(aTHX_ o, name), value);
+
+int
+EXISTS(self, name)
+        SV *self
+        SV *name
+    PREINIT:
+        ac_object o;
+        struct ac_key *k;
+    CODE:
+        o = ac_node_unhandle(aTHX_ ac_view_slots(aTHX_ self)[0], NULL);
+        k = ac_node_key_named(aTHX_ o, name);
+        RETVAL = k && ac_node_exists(aTHX_ o, k);
+    OUTPUT:
+        RETVAL
+
+SV *
+DELETE(self, name)
+        SV *self
+        SV *name
+    PREINIT:
+        ac_object o;
+        struct ac_key *k;
+    CODE:
+        o = ac_node_unhandle(aTHX_ ac_view_slots(aTHX_ self)[0], NULL);
+        k = ac_node_key_named(aTHX_ o, name);
+        RETVAL = newSV(0);
+        if (k && ac_node_exists(aTHX_ o, k))
+        {
+            ac_node_get(aTHX_ o, k, RETVAL);
+            ac_node_delete(aTHX_ o, k);
+        }
+    OUTPUT:
+        RETVAL
+
+void
+CLEAR(self)
+        SV *self
+    PREINIT:
+        ac_object o;
+        struct ac_key *k;
+        UV pos = 0;
+    CODE:
+        o = ac_node_unhandle(aTHX_ ac_view_slots(aTHX_ self)[0], NULL);
+        while ((k = ac_node_next_key(aTHX_ o, &pos)))
+            ac_node_delete(aTHX_ o, k);
+
+SV *
+FIRSTKEY(self)
+        SV *self
+    CODE:
+        sv_setuv(ac_view_slots(aTHX_ self)[1], 0);
+        RETVAL = ac_view_next(aTHX_ self);
+    OUTPUT:
+        RETVAL
+
+SV *
+NEXTKEY(self, ...)
+        SV *self
+    CODE:
+        RETVAL = ac_view_next(aTHX_ self);
+    OUTPUT:
+        RETVAL
+
+UV
+SCALAR(self)
+        SV *self
+    PREINIT:
+        ac_object o;
+        UV pos = 0;
+    CODE:
+        o = ac_node_unhandle(aTHX_ ac_view_slots(aTHX_ self)[0], NULL);
+        RETVAL = 0;
+        while (ac_node_next_key(aTHX_ o, &pos))
+            RETVAL++;
+    OUTPUT:
+        RETVAL
@@ -6,7 +6,10 @@ use warnings;
 use 5.006; # sv_rvweaken
 
 use Sub::Exporter -setup =>
-    { exports =>[ qw/put exists delete get new key/ ] };
+    { exports =>[ qw/put put_many exists delete get new key
+        template new_from_template accessor import_records
+        inflate inflate_many load_delimited class_of
+        new_id get_id put_id exists_id delete_id ref_id unref_id/ ] };
 
 BEGIN {
 
@@ -21,6 +24,13 @@ BEGIN {
     undef @ISA; # namespace pollution FTL
 }
 
+# Calls to get, put and exists with a constant key compile to custom ops.
+_install_ops();
+
+# Nodes still queued for destruction are destroyed before global
+# destruction, so that what they hold is freed in an orderly way.
+END { flush() }
+
 1;
 
 __END__
@@ -80,18 +90,265 @@ Creates a new, empty node, and returns a handle to it.
 =head2 key('name'[, 'type'])
 
 Return a key identifier for the given name and type.  If the type is not
-specified, defaults to scalar.  (Types are not yet implemented.)
+specified, defaults to scalar.  There is one key per name, so asking for an
+existing name with a different type is an error, except that a key first
+asked for without a type may be given one before it is put on any node.
+
+The types are C<sv>, which holds any Perl scalar by reference, and packed
+integers: C<intN> and C<uintN> for signed and unsigned integers of N bits,
+up to the size of a Perl integer, with C<iv> and C<uv> for the largest.
+Storing a value which does not fit an integer field is an error.
+
+=head2 template($key1, $key2, ...)
+
+Returns a constructor template for nodes with the given fields, in the given
+order.  The work of finding where each field lives is done here, once.
+
+=head2 new_from_template($template, $value1, $value2, ...)
+
+Creates a node with the template's fields set to the given values, matched
+up by position.  Fields past the last value given are left unset.  This is
+the fastest way to build many nodes of the same form.
+
+=head2 accessor($key, $template_or_node)
+
+Returns a code reference which gets the field when called as
+C<< $accessor->($node) >> and sets it when called as
+C<< $accessor->($node, $value) >>; install it in a package to get a method.
+The accessor is specialized to nodes built like the template or node given,
+for which it goes straight to the field; it works on any node, but others
+take the ordinary C<get> and C<put> path.
+
+=head2 import_records(\@hashes[, $template])
+
+Makes a node from each hash reference in the array, with a field for each
+hash element, and returns a reference to an array of the nodes.  The
+copying is done entirely in C.  With a template, every node starts out in
+the template's form and its fields are looked up directly; elements the
+template does not name are added as by C<put>.  Without one, hashes with
+the same set of keys give nodes of the same form, whatever order they were
+built in.
+
+=head2 load_delimited($file, $template, option => value, ...)
+
+Reads delimited text, one record per line, into new nodes of the template's
+form, returning a reference to an array of them.  C<$file> is a file name or
+an open handle.  The cells of each record go to the template's keys in
+order; an empty cell leaves its field unset, and a record with more cells
+than the template has keys is an error.  Each cell is converted from text by
+its key's type straight into the node, so loading into integer keys makes
+no Perl values at all beyond the nodes.  Options:
+
+=over
+
+=item sep
+
+The field separator, C<,> by default; use C<"\t"> for TSV.
+
+=item quote
+
+The quote character, C<"> by default, or C<undef> for none.  A quoted cell
+can contain separators, newlines and doubled quotes.
+
+=item header
+
+If true, the first record is skipped.
+
+=back
+
+=head2 inflate($node)
+
+Returns a reference to a new, ordinary hash with an element for each field
+set on the node.
+
+=head2 inflate_many(\@nodes)
+
+Inflates each node in the array, returning a reference to an array of the
+hash references.
 
 =head2 get($node, $key)
 
 Fetches the value of a named field.
 
+When the key is a constant (say from C<use constant>, or written as
+C<key('name')>) and the other arguments are simple scalars, calls to
+C<get>, C<put> and C<exists> are compiled into special ops which skip the
+sub call and the key lookup.  This needs no action on your part.
+
 =head2 put($node, $key, $value)
 
 Sets the value of a named field.
 
 Objects larger than 4088 bytes cannot currently be constructed.
 
+=head2 put_many($node, $key1 => $value1, $key2 => $value2, ...)
+
+Sets several fields at once.  Equivalent to a C<put> for each pair in
+order, but a node gaining several new fields is only moved once, which
+makes this the cheap way to fill in a freshly created node.
+
+All the values are checked before any is stored, so if one is refused
+(say, out of range for its key's type) the node is left as it was.
+
+=head2 exists($node, $key)
+
+True if the node has the named field.
+
+=head2 delete($node, $key)
+
+Removes a named field from the node.  It is an error if the field is not
+present.
+
+=head2 class_of($node)
+
+A reference to the node's class.  Every node with the same keys, added in
+the same order, has the same class; the reference is to the same scalar
+each time, so classes can be compared with C<Scalar::Util::refaddr>.  It is
+the same reference C<profile_dump> gives.
+
+=head1 RAW IDS
+
+Every node handle is a Perl scalar, which is a lot of memory per node when a
+program keeps millions of them, as graph algorithms do.  Nodes can instead
+be made and used by ID: a plain integer, which can be stored in an array or
+packed into a string.  A node made this way has no handle, and its fields
+are reached with the C<_id> functions below.
+
+IDs are not reference counted by Perl.  Each C<new_id> and C<ref_id> must be
+matched by one C<unref_id>, the last of which destroys the node; using an ID
+after that is undefined behaviour, unless checking is on.
+
+L<Arena::Compact::IdArray> keeps IDs packed in an array object which holds
+a count on each.
+
+=head2 new_id([$template])
+
+Makes a node, in the template's shape if one is given, and returns its ID.
+The ID's count starts at one.
+
+=head2 get_id($id, $key), exists_id($id, $key), delete_id($id, $key)
+
+As C<get>, C<exists> and C<delete>.
+
+=head2 put_id($id, $key, $value)
+
+As C<put>, but returns the node's ID, which is different from C<$id> if the
+node had to be moved to hold a new field; the old ID is then invalid.  A
+node whose ID has been shared with C<ref_id> never moves, and keeps new
+fields out of line instead.  Nodes made from a template with all their
+fields never move either.
+
+    $id = put_id($id, $weight, 3);
+
+=head2 ref_id($id), unref_id($id)
+
+Add or drop one count on an ID.
+
+=head2 Arena::Compact::check_ids($on)
+
+Turns ID checking on or off.  While on, every ID given to the functions
+above must be one made (by C<new_id> or C<put_id>) while checking was on,
+and not since destroyed; anything else croaks.  This is not exported.
+
+=head1 LAZY BLESSING
+
+Blessing is a fair part of the cost of a new node handle, and code which
+makes handles in bulk and only passes them back to Arena::Compact never
+looks at the class.  This is not exported.
+
+=head2 Arena::Compact::lazy_bless($on)
+
+While on, new node handles are not blessed until C<ref> or a method call
+is applied to them, when they are blessed into their class as usual.
+Other ways of looking at the class, such as C<Scalar::Util::blessed>,
+C<isa> and stringification, do not trigger it, and see an unblessed
+scalar reference.  Handles made while it was off stay blessed, and those
+made while it was on are still blessed the same way after it is turned
+off.
+
+Only C<ref> and method calls compiled after it is first turned on do the
+blessing, so turn it on in a C<BEGIN> block ahead of the code that needs
+it.  From then on every C<ref> and method call compiled pays for a quick
+check, for the rest of the program; nothing does until then.
+
+=head1 DEFERRED DESTRUCTION
+
+Normally a node is destroyed the moment its last handle goes.  Freeing a
+large structure that way visits its nodes in whatever order Perl frees the
+handles, which is as good as random.  These functions are not exported.
+
+=head2 Arena::Compact::destroy_batch($size)
+
+With a positive C<$size>, nodes whose handles go are queued, and destroyed
+C<$size> at a time, sorted so that each class's storage is visited in
+order.  Values held in queued nodes are only released when the nodes are
+destroyed.  A C<$size> of 0 goes back to destroying at once, and destroys
+anything queued.
+
+=head2 Arena::Compact::flush()
+
+Destroys everything queued now.  This happens anyway at program end.
+
+=head1 PROFILING
+
+Layout decisions - which fields are hot, which are cold, what order they go
+in - are best made from measurements.  These functions are not exported.
+
+=head2 Arena::Compact::profile($on)
+
+Turns access counting on or off.  While on, every get and put is counted
+against the class of the object and the field accessed.
+
+=head2 Arena::Compact::profile_dump()
+
+Returns the counts gathered so far, as an array reference with one entry per
+class that has been accessed:
+
+    [ { class => $class, type => 'record { ... }',
+        fields => { x => { get => 1200, set => 3, weight => 1203,
+                           cold => 0 }, ... } }, ... ]
+
+C<weight> and C<cold> are the layout hints derived from the counts; a field
+is suggested cold if it is accessed less than 1/16 as often as the hottest
+field of its class.
+
+=head2 Arena::Compact::profile_reset()
+
+Zeroes all counts.
+
+=head2 Arena::Compact::hint($key, cold => $bool, weight => $n)
+
+Gives a key layout hints for the node classes made from now on; classes
+which already hold the key keep their layout.  A cold field is kept apart
+from the rest of the node, in pages of its own, so that the fields read on
+every traversal pack densely; reaching it costs an extra cache miss.
+
+Fields are laid out largest first, so that none straddles a word, whatever
+order the keys were added in; a higher C<weight>, such as an access count,
+puts a field ahead of others of the same size.
+
+=head2 Arena::Compact::layout_hints($class)
+
+The hints the counts suggest for a class from C<class_of>, one field spec per
+field:
+
+    [ { name => 'x', type => 'uint32', cold => 0, weight => 1203 }, ... ]
+
+These are what C<profile_dump> reports, ready to give back to C<hint> for
+the keys of the same name, in this program or (more usefully) the next:
+
+    Arena::Compact::hint(key($_->{name}), cold => $_->{cold},
+        weight => $_->{weight}) for @{ Arena::Compact::layout_hints($class) };
+
+=head2 Arena::Compact::layout($class)
+
+Where each field of a class's nodes lives, for a class from C<class_of>:
+
+    { x => { offset => 0, cold => 0 }, ... }
+
+Offsets are in bits from the start of the node, or of its cold storage for
+cold fields.
+
 =head1 RECKONING SIZE
 
 What follows is subject to change in detail but the spirit will remain the
@@ -101,6 +358,15 @@ Each object consumes one word plus the size of a scalar for each field.
 Objects are packed in 4096-byte pages; 2 words of overhead exist for each page.
 Objects with different sets of fields cannot share pages, so for each
 combination of set fields, an integral multiple of 4096 bytes must be allocated.
+Combinations are tracked as a tree of shapes, one per order in which fields
+were first added; nodes built up the same way share a shape, and moving from
+one shape to the next is cached, so the cost of a new combination is paid
+once rather than per node.  Keys which only a few nodes of a shape carry are
+kept in a side table on the shape instead, costing a few words per node
+that has them, and no new shapes.
+Deleting a field does not change the node's shape: each shape carries a
+bitmap with one bit per field saying whether it is set, so a deleted field
+keeps its space until the node is rebuilt, and setting it again is cheap.
 There is also some fixed overhead for each format and key (a small data
 allocation and an entry in a global hashtable).
 
@@ -0,0 +1,49 @@
+#!/usr/bin/env perl
+package Arena::Compact::HashView;
+use strict;
+use warnings;
+
+use Arena::Compact ();
+
+# The tie methods are XSUBs in Arena::Compact's shared object.
+
+sub new {
+    my ($class, $node) = @_;
+
+    my %hash;
+    tie %hash, $class, $node;
+    return \%hash;
+}
+
+1;
+
+__END__
+
+=head1 NAME
+
+Arena::Compact::HashView - Look at a node as if it were a hash
+
+=head1 SYNOPSIS
+
+    use Arena::Compact::HashView;
+
+    my $hash = Arena::Compact::HashView->new($node);
+    $hash->{name} = 'x';            # put($node, key('name'), 'x')
+    print join ',', keys %$hash;    # the fields set on $node
+
+    tie my %h, 'Arena::Compact::HashView', $node;
+
+=head1 DESCRIPTION
+
+A tied hash whose elements are the fields of a node, for code which
+expects a hash reference.  Hash keys are field names; storing under a new
+name makes the key with C<key>.  Fetching or deleting a field that is not
+set gives C<undef>, as for a hash, rather than an error.  All the tie
+methods are implemented in XS and go directly to the node; iteration walks
+the node's shape and makes no list of keys.
+
+=head2 new($node)
+
+Returns a reference to a fresh hash tied to C<$node>.
+
+=cut
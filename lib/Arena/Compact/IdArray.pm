@@ -0,0 +1,86 @@
+#!/usr/bin/env perl
+package Arena::Compact::IdArray;
+use strict;
+use warnings;
+
+use Arena::Compact ();
+
+# The methods are XSUBs in Arena::Compact's shared object.
+
+1;
+
+__END__
+
+=head1 NAME
+
+Arena::Compact::IdArray - A packed array of node IDs
+
+=head1 SYNOPSIS
+
+    use Arena::Compact::IdArray;
+
+    my $edges = Arena::Compact::IdArray->new(@ids);
+    $edges->push($id);
+    my $last = $edges->pop;
+    $edges->unique;
+
+    my $both = $edges->intersect($other_edges);
+    for my $id ($both->ids) { ... }
+
+=head1 DESCRIPTION
+
+An array of raw node IDs (see L<Arena::Compact/RAW IDS>) stored one
+machine word apiece, where a Perl array of node handles costs some 40
+bytes an element.  Sorting, deduplication and intersection are done in
+C.
+
+The array holds a count on each ID it contains, as if by C<ref_id>: taken
+when the ID goes in, dropped when it leaves (by C<pop>, C<clear> or
+C<unique>) or the array is destroyed.  A node in an array therefore stays
+alive, and, its ID being shared, is never moved by C<put_id>.
+
+=head2 new(@ids)
+
+A new array holding the given IDs, in order.
+
+=head2 push(@ids)
+
+Appends IDs.
+
+=head2 pop()
+
+Removes the last ID and returns it, or C<undef> if the array is empty.
+Its count goes with it: if the array held the last one, the node is
+destroyed, and the ID returned is no longer valid.
+
+=head2 clear()
+
+Removes all the IDs, dropping their counts.
+
+=head2 get($index)
+
+The ID at an index, counting from the end if negative; C<undef> past the
+end.
+
+=head2 len()
+
+The number of IDs.
+
+=head2 ids()
+
+All the IDs, as a list.
+
+=head2 sort()
+
+Sorts into ascending ID order, in place.
+
+=head2 unique()
+
+Sorts and removes duplicates, in place.
+
+=head2 intersect($other)
+
+A new array of the IDs in both arrays, sorted and without duplicates.
+Both arrays are sorted as a side effect.
+
+=cut
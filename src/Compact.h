@@ -10,6 +10,15 @@ typedef UV ac_object;
 /* Only this many low bits of ac_object matter */
 extern int ac_param_pointer_size;
 
+/*
+ * Bit offsets with this bit set (and the sign bit clear) address the cold
+ * segment of an object rather than its main storage.  The cold segment is a
+ * parallel set of pages indexed by the same object number, so that rarely
+ * used fields don't dilute the cache lines of frequently used ones.
+ */
+#define AC_COLD_BIT ((UV)1 << (sizeof(UV) * CHAR_BIT - 2))
+#define AC_IS_COLD(off) (((UV)(off) >> (sizeof(UV) * CHAR_BIT - 2)) == 1)
+
 /* He he he.  I wonder how many compilers will decide the croak is not
    reachable. */
 #define AC_OVERFLOW_CHECK(x,y) \
@@ -17,7 +26,7 @@ extern int ac_param_pointer_size;
         if (((UV)(x) + (UV)(y)) < (UV)(x)) \
             croak("Object is not constructable because its size would " \
                     "exceed the size of an unsigned integer."); \
-    }
+    } STMT_END
 
 /*
  * A class consists of a type, some metadata controlling handles and allocation
@@ -59,9 +68,23 @@ struct ac_class
     UV obj_size_bits;
     UV obj_overhead_bits;
 
+    /* The cold segment; see AC_COLD_BIT.  cold_size_bits is 0 if unused. */
+    union ac_page **cold_pages;
+    UV cpa_size;
+    UV num_cold_pages;
+    UV cold_size_bits;
+
+    /* While nonzero, the objects hold one reference to reflection */
     UV used_objects;
     ac_object freelist_head;
 
+    /* The node shape this class holds, if any; see node.c */
+    struct ac_shape *shape;
+
+    /* Access counts, get and set per field; see profile.c */
+    UV *profile_counts;
+    struct ac_class *profile_next;
+
     /* TODO implement compacter
     struct ac_class *nextcl;
     struct ac_class *prevcl;
@@ -83,16 +106,39 @@ struct ac_class *ac_new_class(struct ac_type *ty, UV nbits, int lifetime,
 
 ac_object ac_new_object(struct ac_class *cl);
 
+struct ac_class *ac_class_of(ac_object o);
+struct ac_class *ac_class_unhandle(pTHX_ SV *ref);
+
 void ac_ref_object(ac_object o);
 void ac_unref_object(ac_object o);
 
+/*
+ * Return an object's storage to its class without running destroy hooks;
+ * for use after the contents have been moved elsewhere.
+ */
+void ac_release_object(ac_object o);
+
+/* The deletehandle hook for handles to objects */
+void ac_free_handle(pTHX_ void *op);
+
+/*
+ * While ac_param_destroy_batch is positive, ac_free_handle queues objects
+ * of AC_LIFE_PERL classes, destroying them in batches of that size or when
+ * ac_flush_destroys is called.
+ */
+extern int ac_param_destroy_batch;
+void ac_flush_destroys(void);
+
 /* TODO compactor
 void ac_mark_object(ac_object o);
 
 ac_object ac_forward_object(ac_object o);
 */
 
-/* These should not be assumed to work above 32 */
+/*
+ * These work for any count up to the width of a UV.  Offsets may be
+ * "negative" to reach the lifetime overhead, or cold (see AC_COLD_BIT).
+ */
 UV ac_object_fetch(ac_object o, UV bitoff, UV count);
 IV ac_object_fetch_signed(ac_object o, UV bitoff, UV count);
 /* does no value checking, deliberately */
@@ -119,6 +165,17 @@ struct ac_type_ops
     int (*subobject_exists)(struct ac_type *ty, ac_object obj, UV bit_in_obj,
             SV *name);
 
+    /*
+     * Make an absent subobject present, in its initial state, or absent,
+     * destroying it.  Only types with optional parts (records with presence
+     * bitmaps) support these; they croak if the subobject is already in the
+     * requested state.
+     */
+    void (*subobject_add)(struct ac_type *ty, ac_object obj, UV bit_in_obj,
+            SV *name);
+    void (*subobject_delete)(struct ac_type *ty, ac_object obj,
+            UV bit_in_obj, SV *name);
+
     /* TODO - subobject interrogation and editing, for mutable types */
 
     /* Copy a value out of the (sub)object. */
@@ -129,6 +186,20 @@ struct ac_type_ops
     void (*scalar_put)(struct ac_type *ty, ac_object obj, UV bit_in_obj,
             SV *from);
 
+    /*
+     * Copy in from text, as read from a file, without making an SV for it.
+     * Croaks if the text is not a valid value.
+     */
+    void (*scalar_parse)(struct ac_type *ty, ac_object obj, UV bit_in_obj,
+            const char *pv, STRLEN len);
+
+    /*
+     * Check a value as scalar_put would, and set to to what scalar_get
+     * would then return; for values kept out of line.  NULL if any SV is
+     * stored as it is.
+     */
+    void (*scalar_normalize)(struct ac_type *ty, SV *from, SV *to);
+
     /*
      * Bring an *uninitialized* block of memory to some zero/default state;
      * it will already have been zeroed.
@@ -166,12 +237,16 @@ struct ac_type_ops
 
     /* Convert to a string for diagnostics */
     void (*deparse)(struct ac_type *ty, SV *strbuf);
+
+    /* Free the type itself, once its reflection has died. */
+    void (*free_type)(struct ac_type *ty);
 };
 
 /*
  * Type objects are constructed in a tree to represent all data stored;
- * this is merely the base class.  Hash consing is done at the Perl level
- * (for now; it will probably need to move to XS when retyping editors go in)
+ * this is merely the base class.  Scalar types are hash-consed as they are
+ * made (see scalar.c), so equal scalar types are the same pointer; record
+ * types each belong to one shape or template, which are unique already.
  */
 struct ac_type
 {
@@ -185,13 +260,26 @@ struct ac_type
 #define AC_MARK_USED 16
 #define AC_FORWARDIZE_USED 32
     SV *reflection;
+    /*
+     * Bits this type needs in the cold segment, in addition to inline_size.
+     * Only top-level records with cold fields have this nonzero.
+     */
+    UV cold_size;
 };
 
+/* Handles for types; the deletehandle hook frees the type. */
+extern struct ac_handle_sort ac_hs_type;
+
+/* Set up the common part of a new type, including its reflection. */
+void ac_init_type(struct ac_type *ty, struct ac_type_ops *ops, UV size,
+        unsigned int flags);
+
 /*
  * Constructs an integer type (with one reference).  TODO: support bit sizes
  * over sizeof(IV)*CHAR_BIT; perhaps as a separate Math::BigInt type.
  */
 struct ac_type *ac_make_int_type(int bits);
+struct ac_type *ac_make_uint_type(int bits);
 
 /* A floating type of defined precision. */
 struct ac_type *ac_make_float_type(int expbits, int sigbits);
@@ -212,9 +300,65 @@ struct ac_type *ac_make_ucs4_char_type(void);
 /* TODO decide on string variants - expected size and references! */
 struct ac_type *ac_make_string_type(void);
 
+/*
+ * A whole Perl scalar, kept out of line as a pointer.  This is what node
+ * fields hold unless their key says otherwise.
+ */
+struct ac_type *ac_make_sv_type(void);
+
+/*
+ * A scalar type by name, as given to key(): "sv", "iv", "uv", "intN" or
+ * "uintN".  Croaks for anything else.
+ */
+struct ac_type *ac_make_type_named(pTHX_ const char *name);
+
 struct ac_type *ac_make_record_type(int nfields, const char **names,
         struct ac_type **types);
 
+/*
+ * The long form of ac_make_record_type, which allows per-field layout
+ * control.  Cold fields are stored in the class's cold segment; records
+ * with cold fields may only be used as the type of a class, not nested.
+ *
+ * Fields are not laid out in the order given; see ac_record_layout in
+ * record.c.  weight is a relative access frequency, or 0 if unknown, and
+ * only affects ordering among fields of compatible alignment.
+ *
+ * Optional fields have a bit each in a per-object presence bitmap, and
+ * start out absent; subobject_add and subobject_delete flip the bit.
+ *
+ * A namelen of 0 means the name is NUL-terminated.
+ */
+struct ac_field_spec
+{
+    const char *name;
+    STRLEN namelen;
+    struct ac_type *type;
+    unsigned int flags;
+#define AC_FIELD_COLD 1
+#define AC_FIELD_OPTIONAL 2
+    UV weight;
+};
+
+struct ac_type *ac_make_record_type_spec(int nfields,
+        const struct ac_field_spec *fields);
+
+/*
+ * Record introspection.  ac_record_nfields returns -1 for non-records;
+ * ac_record_field_at returns the index of the field containing a bit offset,
+ * or -1; ac_record_field_spec's name is borrowed from the type.
+ * ac_record_locate finds a field's type, offset and presence bit offset
+ * (AC_ALWAYS_PRESENT if it is not optional) without reference to any
+ * object, or NULL if there is no such field.
+ */
+#define AC_ALWAYS_PRESENT (~(UV)0)
+
+int ac_record_nfields(struct ac_type *ty);
+struct ac_type *ac_record_locate(struct ac_type *ty, SV *name, UV *offp,
+        UV *pbitp);
+int ac_record_field_at(struct ac_type *ty, UV off);
+void ac_record_field_spec(struct ac_type *ty, int ix, struct ac_field_spec *sp);
+
 /* TODO variants by size */
 struct ac_type *ac_make_hash_type(struct ac_type *kt, struct ac_type *vt);
 struct ac_type *ac_make_array_type(struct ac_type *et);
@@ -248,5 +392,165 @@ void ac_do_set(struct ac_type *ty, ac_object o, UV off, SV *val);
 void ac_do_get(struct ac_type *ty, ac_object o, UV off, SV *ret);
 
 int ac_child_exists(struct ac_type *ty, ac_object o, UV off, SV *sel);
+void ac_child_add(struct ac_type *ty, ac_object o, UV off, SV *sel);
+void ac_child_delete(struct ac_type *ty, ac_object o, UV off, SV *sel);
+
+/*
+ * Nodes - the schemaless objects of the Perl API.  A node's class is
+ * determined by its shape, the sequence of keys it was given; see node.c.
+ *
+ * Each key caches its resolution against the last few classes it was used
+ * with; ty is NULL if the class has no such field, and pbit is the field's
+ * presence bit.  Only node classes are cached, and those live forever, so
+ * entries never go stale.
+ */
+#define AC_KEY_IC_SIZE 4
+
+struct ac_key_ic
+{
+    struct ac_class *cl;
+    UV off;
+    UV pbit;
+    struct ac_type *ty;
+};
+
+struct ac_key
+{
+    SV *name;
+    struct ac_type *type;
+    SV *reflection;
+
+    /*
+     * A key made without a type (as key('name') is at compile time) can be
+     * given one later, until it is first used in a shape.
+     */
+    int typed;
+    int fixed;
+
+    /*
+     * Layout hints for shapes made from now on: AC_FIELD_COLD, and a weight
+     * as in struct ac_field_spec.
+     */
+    unsigned int layout_flags;
+    UV weight;
+
+    struct ac_key_ic ic[AC_KEY_IC_SIZE];
+    int ic_next;
+};
+
+/*
+ * A constructor template: a node shape chosen up front, with each key's
+ * field resolved, so that filling a new node is a run of stores.
+ */
+struct ac_template
+{
+    struct ac_class *cl;
+    int nkeys;
+    struct ac_key **keys;
+    UV *offsets;
+    UV *pbits;
+    SV *reflection;
+};
+
+/* Thresholds for keeping keys out of line; see node.c */
+extern int ac_param_sparse_children;
+extern int ac_param_sparse_shapes;
+extern int ac_param_sparse_ratio;
+
+extern struct ac_handle_sort ac_hs_node;
+extern struct ac_handle_sort ac_hs_key;
+extern struct ac_handle_sort ac_hs_template;
+
+/* See ac_setup_node_handle */
+extern int ac_param_lazy_bless;
+void ac_node_bless(pTHX_ SV *ref);
+
+SV *ac_node_new(pTHX);
+ac_object ac_node_new_object(pTHX_ struct ac_template *tpl);
+void ac_node_destroy(pTHX_ ac_object o);
+ac_object ac_node_unhandle(pTHX_ SV *ref, SV **handlep);
+SV *ac_key(pTHX_ SV *name, struct ac_type *ty);
+struct ac_key *ac_key_unhandle(pTHX_ SV *ref);
+struct ac_key *ac_key_intern(pTHX_ SV *name);
+SV *ac_template_new(pTHX_ struct ac_key **keys, int count);
+struct ac_template *ac_template_unhandle(pTHX_ SV *ref);
+SV *ac_node_new_from_template(pTHX_ struct ac_template *tpl, SV **vals,
+        int count);
+
+void ac_node_get(pTHX_ ac_object o, struct ac_key *k, SV *ret);
+ac_object ac_node_store(pTHX_ ac_object o, SV *handle, int fixed,
+        struct ac_key *k, SV *val);
+void ac_node_put(pTHX_ SV *handle, struct ac_key *k, SV *val);
+void ac_node_put_many(pTHX_ SV *handle, struct ac_key **keys, SV **vals,
+        int count);
+int ac_node_exists(pTHX_ ac_object o, struct ac_key *k);
+void ac_node_delete(pTHX_ ac_object o, struct ac_key *k);
+struct ac_key *ac_node_key_named(pTHX_ ac_object o, SV *name);
+struct ac_key *ac_node_next_key(pTHX_ ac_object o, UV *posp);
+SV *ac_node_import(pTHX_ AV *recs, struct ac_template *tpl);
+SV *ac_node_inflate(pTHX_ ac_object o);
+
+/*
+ * Raw node IDs, which stand for nodes without handles; see ids.c.  IDs are
+ * counted by hand, and checked only while ac_param_check_ids is set.
+ */
+extern int ac_param_check_ids;
+
+UV ac_id_new(pTHX_ struct ac_template *tpl);
+ac_object ac_id_check(pTHX_ UV id);
+UV ac_id_put(pTHX_ UV id, struct ac_key *k, SV *val);
+void ac_id_ref(pTHX_ UV id);
+void ac_id_unref(pTHX_ UV id);
+
+/* Packed arrays of node IDs, each holding a count; see idarray.c */
+struct ac_id_array
+{
+    UV *ids;
+    UV count;
+    UV size;
+    int sorted;
+};
+
+SV *ac_id_array_new(pTHX_ HV *stash);
+struct ac_id_array *ac_id_array_unhandle(pTHX_ SV *ref);
+void ac_id_array_push(pTHX_ struct ac_id_array *a, UV id);
+UV ac_id_array_pop(pTHX_ struct ac_id_array *a);
+void ac_id_array_clear(pTHX_ struct ac_id_array *a);
+void ac_id_array_sort(struct ac_id_array *a);
+void ac_id_array_unique(pTHX_ struct ac_id_array *a);
+SV *ac_id_array_intersect(pTHX_ SV *aref, struct ac_id_array *b);
+
+/* Accessor XSUBs bound to one key and node class; see accessor.c */
+SV *ac_accessor_new(pTHX_ struct ac_key *k, struct ac_class *cl);
+
+/* Delimited text into nodes of a template's class; see loader.c */
+SV *ac_load_delimited(pTHX_ PerlIO *fp, struct ac_template *tpl, int sep,
+        int quote, int header);
+
+/* Call checkers folding constant keys into custom ops; see ops.c */
+void ac_install_ops(pTHX);
+
+/* The ref and method op wrappers for lazy blessing; see ops.c */
+void ac_install_lazy_ops(pTHX);
+
+/*
+ * Access profiling.  While ac_param_profile is set, ac_do_get and ac_do_set
+ * count accesses per class and top-level field.  The hints are a field spec
+ * for the class's record type, weighted by the counts, with fields accessed
+ * less than 1/ac_param_profile_cold_ratio as often as the hottest marked
+ * cold; feed it to ac_make_record_type_spec.
+ */
+extern int ac_param_profile;
+extern int ac_param_profile_cold_ratio;
+
+void ac_profile_count(ac_object o, UV off, int is_set);
+void ac_profile_reset(void);
+void ac_profile_forget(struct ac_class *cl);
+int ac_profile_hints(struct ac_class *cl, struct ac_field_spec **specp);
+SV *ac_profile_dump(pTHX);
+
+/* The hints and the layout of a record class, as Perl data */
+SV *ac_profile_hints_dump(pTHX_ struct ac_class *cl);
+SV *ac_layout_dump(pTHX_ struct ac_class *cl);
 
 #endif
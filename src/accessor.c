@@ -0,0 +1,119 @@
+#include <EXTERN.h>
+#include <perl.h>
+#include <XSUB.h>
+
+#include "handle.h"
+#include "Compact.h"
+
+/*
+ * Generated accessors.  An accessor is an anonymous XSUB bound to one key
+ * and one node class; the field's offset, presence bit and the type's
+ * get/put functions are resolved when the accessor is made and hang off
+ * CvXSUBANY.  Called on a node of that class, it goes straight to the
+ * field.  Anything else (another class, a field that is not set, profiling
+ * turned on) takes the ordinary node path, so an accessor is never wrong,
+ * only sometimes no faster.
+ *
+ * The binding is owned by the CV through a bit of free magic.
+ */
+
+struct ac_accessor
+{
+    struct ac_class *cl;
+    struct ac_key *key;
+    struct ac_type *ty;
+    UV off;
+    UV pbit;
+
+    void (*get)(struct ac_type *ty, ac_object obj, UV bit_in_obj, SV *ret);
+    void (*put)(struct ac_type *ty, ac_object obj, UV bit_in_obj, SV *from);
+};
+
+static int ac_free_accessor(pTHX_ SV *sv, MAGIC *mg)
+{
+    struct ac_accessor *acc = (struct ac_accessor *) mg->mg_ptr;
+
+    SvREFCNT_dec(acc->key->reflection);
+    Safefree(acc);
+    return 0;
+}
+
+static MGVTBL ac_accessor_vtbl = {
+    0, 0, 0, 0, ac_free_accessor, AC_NULL_COPY AC_NULL_DUP AC_NULL_LOCAL
+};
+
+static XS(ac_accessor_xsub)
+{
+    dXSARGS;
+    struct ac_accessor *acc = (struct ac_accessor *) CvXSUBANY(cv).any_ptr;
+    SV *handle;
+    ac_object o;
+    int fast;
+
+    if (items != 1 && items != 2)
+        croak("Usage: $node->accessor([value])");
+
+    o = ac_node_unhandle(aTHX_ ST(0), &handle);
+    fast = acc->cl == ac_class_of(o) && !ac_param_profile;
+
+    if (items == 2)
+    {
+        /* An absent field needing initialization is the node path's job */
+        if (fast && acc->put && (acc->pbit == AC_ALWAYS_PRESENT ||
+                    !(acc->ty->flags & AC_INITIALIZE_USED) ||
+                    ac_object_fetch(o, acc->pbit, 1)))
+        {
+            /* put may refuse the value, so the field appears only after */
+            acc->put(acc->ty, o, acc->off, ST(1));
+            if (acc->pbit != AC_ALWAYS_PRESENT)
+                ac_object_store(o, acc->pbit, 1, 1);
+        }
+        else
+        {
+            ac_node_put(aTHX_ handle, acc->key, ST(1));
+        }
+
+        XSRETURN_EMPTY;
+    }
+
+    ST(0) = sv_newmortal();
+
+    if (fast && acc->get && (acc->pbit == AC_ALWAYS_PRESENT ||
+                ac_object_fetch(o, acc->pbit, 1)))
+        acc->get(acc->ty, o, acc->off, ST(0));
+    else
+        ac_node_get(aTHX_ o, acc->key, ST(0));
+
+    XSRETURN(1);
+}
+
+/*
+ * Make an accessor for k on nodes of class cl.  If cl has no dense field
+ * for k the accessor still works, it just always takes the slow path.
+ */
+SV *ac_accessor_new(pTHX_ struct ac_key *k, struct ac_class *cl)
+{
+    struct ac_accessor *acc;
+    CV *cv;
+
+    Newxz(acc, 1, struct ac_accessor);
+    acc->cl = cl;
+    acc->key = k;
+    acc->ty = ac_record_locate(cl->dtype, k->name, &acc->off, &acc->pbit);
+
+    if (acc->ty)
+    {
+        acc->get = acc->ty->ops->scalar_get;
+        acc->put = acc->ty->ops->scalar_put;
+    }
+
+    SvREFCNT_inc(k->reflection);
+    k->fixed = 1;
+
+    cv = newXS(NULL, ac_accessor_xsub, __FILE__);
+    CvXSUBANY(cv).any_ptr = acc;
+    sv_magicext((SV *) cv, 0, PERL_MAGIC_ext, &ac_accessor_vtbl,
+            (const char *) acc, 0);
+
+    return newRV_noinc((SV *) cv);
+}
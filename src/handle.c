@@ -3,8 +3,6 @@
 
 #include "handle.h"
 
-#define HASHPTR(p,s) (((0x9E3779B9UL * PTR2UV(p)) & 0xFFFFFFFFUL) >> s)
-
 /*
  * This file implements a system of idiotproof Perl->C handles - scalars which
  * are magically bound to C values, and cannot be tampered with from Perl code
@@ -13,27 +11,47 @@
  *
  * We store the SV->C association on a magic record.  The authority for how
  * fields can be safely used is Perl_mg_free.  Currently, mg_ptr points to the
- * C-side data, and mg_obj points to the next SV in the hash chain.
+ * C-side data; the C->SV direction, for canonical sorts, is a hash table
+ * of its own which never looks inside the SVs.
  */
 
-static int ac_free_handle_magic(pTHX_ SV *handle, MAGIC *mg);
-
+/*
+ * Our magic is normally first on a handle, and the handle normally of the
+ * exact sort asked for, so that case is a single compare.  Otherwise the
+ * whole chain is searched, and our magic found behind some other (say the
+ * backreferences a weak reference adds) is moved back to the front for
+ * next time; nothing else on a handle cares about the order.
+ */
 static MAGIC *ac_find_magic(pTHX_ SV *scalar, ac_handle_sort *btype,
         const char *crk)
 {
-    MAGIC *mgp = SvMAGICAL(scalar) ? SvMAGIC(scalar) : NULL;
+    MAGIC *mgp = SvTYPE(scalar) >= SVt_PVMG ? SvMAGIC(scalar) : NULL;
+    MAGIC **prevp = NULL;
+
+    if (mgp && mgp->mg_virtual == &btype->magic_type)
+        return mgp;
 
-    for (; mgp; mgp = mgp->mg_moremagic)
+    for (; mgp; prevp = &mgp->mg_moremagic, mgp = mgp->mg_moremagic)
     {
         ac_handle_sort *spec;
 
-        if (mgp->mg_virtual->svt_free != ac_free_handle_magic)
+        if (!mgp->mg_virtual ||
+                mgp->mg_virtual->svt_free != ac_free_handle_magic)
             continue;
 
         spec = (ac_handle_sort *) (mgp->mg_virtual);
 
-        if (spec->eq_class == btype->eq_class)
-            return mgp;
+        if (spec->eq_class != btype->eq_class)
+            continue;
+
+        if (prevp)
+        {
+            *prevp = mgp->mg_moremagic;
+            mgp->mg_moremagic = SvMAGIC(scalar);
+            SvMAGIC_set(scalar, mgp);
+        }
+
+        return mgp;
     }
 
     if (crk)
@@ -42,26 +60,156 @@ static MAGIC *ac_find_magic(pTHX_ SV *scalar, ac_handle_sort *btype,
     return NULL;
 }
 
-static int ac_free_handle_magic(pTHX_ SV *handle, MAGIC *mg)
+/*
+ * Canonical tables use open addressing with linear probing over
+ * (pointer, handle) pairs, so a probe stays within a cache line or two and
+ * never touches the handles.  Deleted slots become tombstones, which
+ * probes pass over and inserts reuse.  The capacity is a power of two; the
+ * table is kept under 3/4 full counting tombstones, and over 1/8 full of
+ * live entries unless at the minimum size.
+ *
+ * Resizing is incremental: the old table is kept alongside the new one,
+ * and every link or unlink moves the next AC_REHASH_STEPS old slots over,
+ * so no single operation pays for the whole table.  Lookups try the new
+ * table, then the old; new entries only go in the new one.
+ */
+#define AC_HTAB_MIN 32
+#define AC_REHASH_STEPS 8
+
+static SV ac_htab_dead_sv;
+#define AC_HTAB_DEAD (&ac_htab_dead_sv)
+
+static UV ac_hash_ptr(void *p)
 {
-    ac_handle_sort *hs = (ac_handle_sort *)(mg->mg_virtual);
+    UV h = PTR2UV(p);
+
+#if UVSIZE >= 8
+    h ^= h >> 33;
+    h *= (UV) 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+#else
+    h ^= h >> 16;
+    h *= (UV) 0x85EBCA6BUL;
+    h ^= h >> 13;
+#endif
+
+    return h;
+}
 
-    if (hs->needcanon) {
-        SV **chainp = &(hs->htab[HASHPTR(mg->mg_ptr, hs->shift)]);
+static struct ac_htab_entry *ac_htab_find(struct ac_htab_entry *tab,
+        UV mask, void *key)
+{
+    UV i;
 
-        while (*chainp) {
-            if (*chainp == handle) {
-                *chainp = (SV *)mg->mg_obj;
-                break;
-            }
+    for (i = ac_hash_ptr(key) & mask; tab[i].handle; i = (i + 1) & mask)
+        if (tab[i].key == key && tab[i].handle != AC_HTAB_DEAD)
+            return &tab[i];
 
-            MAGIC *mgi = ac_find_magic(aTHX_ *chainp, hs,
-                    "internal error: corrupted magic chain in Arena::Compact");
+    return NULL;
+}
+
+/* The entry for key in either table, or NULL */
+static struct ac_htab_entry *ac_htab_lookup(ac_handle_sort *hs, void *key)
+{
+    struct ac_htab_entry *e = ac_htab_find(hs->htab, hs->hmask, key);
 
-            chainp = (SV **) &(mgi->mg_obj);
+    if (!e && hs->oldtab)
+        e = ac_htab_find(hs->oldtab, hs->oldmask, key);
+
+    return e;
+}
+
+static void ac_htab_insert(ac_handle_sort *hs, void *key, SV *handle)
+{
+    UV i = ac_hash_ptr(key) & hs->hmask;
+
+    while (hs->htab[i].handle && hs->htab[i].handle != AC_HTAB_DEAD)
+        i = (i + 1) & hs->hmask;
+
+    if (!hs->htab[i].handle)
+        hs->hfilled++;
+
+    hs->htab[i].key = key;
+    hs->htab[i].handle = handle;
+}
+
+static void ac_rehash_step(ac_handle_sort *hs)
+{
+    int i;
+
+    for (i = 0; i < AC_REHASH_STEPS && hs->oldtab; i++)
+    {
+        struct ac_htab_entry *e = &hs->oldtab[hs->rehash_pos++];
+
+        if (e->handle && e->handle != AC_HTAB_DEAD)
+        {
+            ac_htab_insert(hs, e->key, e->handle);
+            e->handle = AC_HTAB_DEAD;
+        }
+
+        if (hs->rehash_pos > hs->oldmask)
+        {
+            Safefree(hs->oldtab);
+            hs->oldtab = NULL;
         }
-        hs->hused--;
     }
+}
+
+/*
+ * Start a resize if the table is too full (of entries or tombstones) or
+ * too empty, and do some of any resize in progress.  A table full of
+ * tombstones is "resized" to the same capacity to clear them.
+ */
+static void ac_rehash_check(ac_handle_sort *hs)
+{
+    UV cap = hs->hmask + 1;
+
+    if (!hs->oldtab)
+    {
+        if (hs->hfilled >= cap / 4 * 3)
+            cap = hs->hused >= cap / 2 ? cap * 2 : cap;
+        else if (hs->hused < cap / 8 && cap > AC_HTAB_MIN)
+            cap /= 2;
+        else
+            return;
+
+        hs->oldtab = hs->htab;
+        hs->oldmask = hs->hmask;
+        hs->rehash_pos = 0;
+        Newxz(hs->htab, cap, struct ac_htab_entry);
+        hs->hmask = cap - 1;
+        hs->hfilled = 0;
+    }
+
+    ac_rehash_step(hs);
+}
+
+static void ac_unlink_handle(pTHX_ ac_handle_sort *hs, SV *handle,
+        MAGIC *mg)
+{
+    struct ac_htab_entry *e = ac_htab_lookup(hs, mg->mg_ptr);
+
+    if (!e || e->handle != handle)
+        croak("internal error: corrupted handle table in Arena::Compact");
+
+    e->handle = AC_HTAB_DEAD;
+    hs->hused--;
+    ac_rehash_check(hs);
+}
+
+static void ac_link_handle(pTHX_ ac_handle_sort *hs, SV *handle, MAGIC *mg)
+{
+    ac_htab_insert(hs, mg->mg_ptr, handle);
+    hs->hused++;
+    ac_rehash_check(hs);
+}
+
+int ac_free_handle_magic(pTHX_ SV *handle, MAGIC *mg)
+{
+    ac_handle_sort *hs = (ac_handle_sort *)(mg->mg_virtual);
+
+    if (hs->needcanon)
+        ac_unlink_handle(aTHX_ hs, handle, mg);
 
     hs->deletehandle(aTHX_ mg->mg_ptr);
 
@@ -79,6 +227,13 @@ void *ac_unhandle(pTHX_ ac_handle_sort *kind, SV *val, void **cookieret,
     return !mg ? NULL : mg->mg_ptr;
 }
 
+/*
+ * Handle SVs are not recycled.  Perl releases a handle's body and magic in
+ * sv_clear, before (or while) our free hook runs, so the only way to keep
+ * one is resurrecting it from a DESTROY method, and calling DESTROY on every
+ * handle costs more than making a new one.  Instead the new SV is made a
+ * PVMG outright, saving sv_magicext the upgrade.
+ */
 SV *ac_rehandle(pTHX_ ac_handle_sort *kind, void *val)
 {
     SV *sv;
@@ -86,32 +241,23 @@ SV *ac_rehandle(pTHX_ ac_handle_sort *kind, void *val)
 
     if (kind->needcanon && kind->htab) {
         /* There may already be a handle for this object. */
-        SV *itr = kind->htab[HASHPTR(val, kind->shift)];
-
-        while (itr) {
-            MAGIC *mgi = ac_find_magic(aTHX_ itr, kind,
-                    "corruption in Arena::Compact hash chain");
-            if (mgi->mg_ptr == val)
-                return SvREFCNT_inc(itr);
-            itr = (SV *)mg->mg_obj;
-        }
+        struct ac_htab_entry *e = ac_htab_lookup(kind, val);
+
+        if (e)
+            return SvREFCNT_inc(e->handle);
     }
 
-    sv = newSV(0);
+    sv = newSV_type(SVt_PVMG);
     mg = sv_magicext(sv, 0, PERL_MAGIC_ext, &kind->magic_type, 0, 0);
     mg->mg_ptr = val;
 
     if (kind->needcanon) {
         if (!kind->htab) {
-            Newxz(kind->htab, 32, SV *);
-            kind->shift = 27;
+            Newxz(kind->htab, AC_HTAB_MIN, struct ac_htab_entry);
+            kind->hmask = AC_HTAB_MIN - 1;
         }
 
-        /* TODO: rehashing */
-
-        UV hash = (UV)HASHPTR(val, kind->shift);
-        mg->mg_obj = kind->htab[hash];
-        kind->htab[hash] = sv;
+        ac_link_handle(aTHX_ kind, sv, mg);
     }
 
     if (kind->setuphandle)
@@ -120,13 +266,28 @@ SV *ac_rehandle(pTHX_ ac_handle_sort *kind, void *val)
     return sv;
 }
 
+void ac_rehome_handle(pTHX_ ac_handle_sort *kind, SV *handle, void *val)
+{
+    MAGIC *mg = ac_find_magic(aTHX_ handle, kind,
+            "internal error: rehoming something which is not a handle");
+
+    if (kind->needcanon)
+        ac_unlink_handle(aTHX_ kind, handle, mg);
+
+    mg->mg_ptr = val;
+
+    if (kind->needcanon)
+        ac_link_handle(aTHX_ kind, handle, mg);
+}
+
 ac_handle_sort *ac_instance_sort(ac_handle_sort *base, void *cookie, int can)
 {
     ac_handle_sort *ns;
     Newx(ns, 1, ac_handle_sort);
-    Copy(ns, base, 1, ac_handle_sort);
+    Copy(base, ns, 1, ac_handle_sort);
 
-    ns->htab = NULL; /* unshare */
+    ns->htab = ns->oldtab = NULL; /* unshare */
+    ns->hused = ns->hfilled = 0;
     ns->cookie = cookie;
     ns->needcanon = can;
 
@@ -136,5 +297,45 @@ ac_handle_sort *ac_instance_sort(ac_handle_sort *base, void *cookie, int can)
 void ac_free_sort(ac_handle_sort *in)
 {
     Safefree(in->htab);
+    Safefree(in->oldtab);
     Safefree(in);
 }
+
+#ifdef AC_TEST_HOOKS
+/*
+ * No handle sort in the module is canonical yet.  This one, built only for
+ * the tests, has nothing behind its handles, so that they can push a table
+ * through resizes and deletions: the value for n is just n + 1.
+ */
+static void ac_canon_test_delete(pTHX_ void *val)
+{
+}
+
+static AC_DEFINE_HANDLE_SORT(hs_canon_test, 0, ac_canon_test_delete);
+
+SV *ac_canon_test_handle(pTHX_ UV n)
+{
+    ac_hs_canon_test.needcanon = 1;
+
+    return ac_rehandle(aTHX_ &ac_hs_canon_test, INT2PTR(void *, n + 1));
+}
+
+UV ac_canon_test_value(pTHX_ SV *handle)
+{
+    return PTR2UV(ac_unhandle(aTHX_ &ac_hs_canon_test, handle, NULL,
+                "not a test handle")) - 1;
+}
+
+void ac_canon_test_rehome(pTHX_ SV *handle, UV n)
+{
+    ac_rehome_handle(aTHX_ &ac_hs_canon_test, handle, INT2PTR(void *, n + 1));
+}
+
+/* Live entries, capacity, and whether a resize is under way */
+void ac_canon_test_stats(UV *used, UV *size, int *resizing)
+{
+    *used = ac_hs_canon_test.hused;
+    *size = ac_hs_canon_test.htab ? ac_hs_canon_test.hmask + 1 : 0;
+    *resizing = ac_hs_canon_test.oldtab != NULL;
+}
+#endif
@@ -5,19 +5,32 @@ typedef struct ac_handle_sort
 {
     MGVTBL magic_type;
 
-    void (*setuphandle)(SV *handle, void *obj);
-    void (*deletehandle)(void *obj);
+    void (*setuphandle)(pTHX_ SV *handle, void *obj);
+    void (*deletehandle)(pTHX_ void *obj);
 
     struct ac_handle_sort *eq_class;
     void  *cookie;
 
     int needcanon;
 
-    SV **htab;
-    int shift;
+    /* The canonical table; see handle.c */
+    struct ac_htab_entry *htab;
+    UV hmask;
     UV hused;
+    UV hfilled;
+
+    /* While resizing, the old table, moved up to rehash_pos */
+    struct ac_htab_entry *oldtab;
+    UV oldmask;
+    UV rehash_pos;
 } ac_handle_sort;
 
+struct ac_htab_entry
+{
+    void *key;
+    SV *handle;
+};
+
 #if MGf_COPY
 #define AC_NULL_COPY NULL,
 #else
@@ -36,19 +49,33 @@ typedef struct ac_handle_sort
 #define AC_NULL_LOCAL
 #endif
 
+int ac_free_handle_magic(pTHX_ SV *handle, MAGIC *mg);
+
 #define AC_DEFINE_HANDLE_SORT(name, newfn, delfn) \
     struct ac_handle_sort ac_##name = { \
-        { 0, 0, 0, 0, ac_free_handle_magic, AC_NULL_COPY, AC_NULL_DUP, \
-          AC_NULL_LOCAL}, newfn, delfn, &ac_##name, 0, 0, 0, 0, 0 }
+        { 0, 0, 0, 0, ac_free_handle_magic, AC_NULL_COPY AC_NULL_DUP \
+          AC_NULL_LOCAL}, newfn, delfn, &ac_##name, 0, 0, 0, 0, 0, 0, 0, 0, \
+        0 }
 
 void *ac_unhandle(pTHX_ ac_handle_sort *bkind, SV *value, void **cookieret,
         const char *err);
 
 SV *ac_rehandle(pTHX_ ac_handle_sort *kind, void *inner);
 
+/* Point an existing handle at a new value, as when an object moves. */
+void ac_rehome_handle(pTHX_ ac_handle_sort *kind, SV *handle, void *inner);
+
 ac_handle_sort *ac_instance_sort(ac_handle_sort *basic, void *cookie,
         int canonical);
 
 void ac_free_sort(ac_handle_sort *in);
 
+#ifdef AC_TEST_HOOKS
+/* A canonical sort for the tests; see handle.c */
+SV *ac_canon_test_handle(pTHX_ UV n);
+UV ac_canon_test_value(pTHX_ SV *handle);
+void ac_canon_test_rehome(pTHX_ SV *handle, UV n);
+void ac_canon_test_stats(UV *used, UV *size, int *resizing);
+#endif
+
 #endif
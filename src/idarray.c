@@ -0,0 +1,153 @@
+#include <EXTERN.h>
+#include <perl.h>
+
+#include "handle.h"
+#include "Compact.h"
+
+/*
+ * Arrays of node IDs, packed one UV apiece, for adjacency lists, result
+ * sets and the like.  The array holds a count on each ID it contains (see
+ * ids.c), taken as the ID goes in and dropped as it leaves, so a node lives
+ * at least as long as any array it is in.  Holding a count also keeps the
+ * node from moving.  IDs leave by pop, clear and unique.
+ *
+ * sort orders by ID, which is allocation order within a class; unique and
+ * intersect work on sorted arrays, and sort them first if need be.
+ */
+
+static void ac_delete_id_array(pTHX_ void *ap)
+{
+    struct ac_id_array *a = (struct ac_id_array *) ap;
+    UV i;
+
+    /* the count table may be gone already */
+    if (PL_phase != PERL_PHASE_DESTRUCT)
+        for (i = 0; i < a->count; i++)
+            ac_id_unref(aTHX_ a->ids[i]);
+
+    Safefree(a->ids);
+    Safefree(a);
+}
+
+AC_DEFINE_HANDLE_SORT(hs_id_array, 0, ac_delete_id_array);
+
+SV *ac_id_array_new(pTHX_ HV *stash)
+{
+    struct ac_id_array *a;
+    SV *ref;
+
+    Newxz(a, 1, struct ac_id_array);
+    ref = newRV_noinc(ac_rehandle(aTHX_ &ac_hs_id_array, a));
+
+    return sv_bless(ref, stash);
+}
+
+struct ac_id_array *ac_id_array_unhandle(pTHX_ SV *ref)
+{
+    if (!SvROK(ref))
+        croak("ID array must be a reference");
+
+    return (struct ac_id_array *) ac_unhandle(aTHX_ &ac_hs_id_array,
+            SvRV(ref), NULL, "ID array has incorrect magic");
+}
+
+void ac_id_array_push(pTHX_ struct ac_id_array *a, UV id)
+{
+    ac_id_ref(aTHX_ id);
+
+    if (a->count == a->size)
+    {
+        a->size = a->size ? a->size * 2 : 8;
+        Renew(a->ids, a->size, UV);
+    }
+
+    a->ids[a->count++] = id;
+    a->sorted = a->count == 1 || (a->sorted && a->ids[a->count - 2] <= id);
+}
+
+/* Removes and returns the last ID, dropping its count; 0 if empty */
+UV ac_id_array_pop(pTHX_ struct ac_id_array *a)
+{
+    UV id;
+
+    if (!a->count)
+        return 0;
+
+    id = a->ids[--a->count];
+    ac_id_unref(aTHX_ id);
+
+    return id;
+}
+
+void ac_id_array_clear(pTHX_ struct ac_id_array *a)
+{
+    while (a->count)
+        ac_id_unref(aTHX_ a->ids[--a->count]);
+
+    a->sorted = 1;
+}
+
+static int ac_id_cmp(const void *x, const void *y)
+{
+    UV a = *(const UV *) x, b = *(const UV *) y;
+
+    return a < b ? -1 : a > b;
+}
+
+void ac_id_array_sort(struct ac_id_array *a)
+{
+    if (!a->sorted)
+        qsort(a->ids, a->count, sizeof(UV), ac_id_cmp);
+
+    a->sorted = 1;
+}
+
+void ac_id_array_unique(pTHX_ struct ac_id_array *a)
+{
+    UV i, n = 0;
+
+    ac_id_array_sort(a);
+
+    for (i = 0; i < a->count; i++)
+    {
+        if (n && a->ids[n - 1] == a->ids[i])
+            ac_id_unref(aTHX_ a->ids[i]);
+        else
+            a->ids[n++] = a->ids[i];
+    }
+
+    a->count = n;
+}
+
+/* The IDs in both, once each, in a new array blessed like a's handle */
+SV *ac_id_array_intersect(pTHX_ SV *aref, struct ac_id_array *b)
+{
+    struct ac_id_array *a = ac_id_array_unhandle(aTHX_ aref);
+    SV *ret = ac_id_array_new(aTHX_ SvSTASH(SvRV(aref)));
+    struct ac_id_array *r = ac_id_array_unhandle(aTHX_ ret);
+    UV i = 0, j = 0;
+
+    ac_id_array_sort(a);
+    ac_id_array_sort(b);
+
+    while (i < a->count && j < b->count)
+    {
+        if (a->ids[i] < b->ids[j])
+        {
+            i++;
+        }
+        else if (a->ids[i] > b->ids[j])
+        {
+            j++;
+        }
+        else
+        {
+            if (!r->count || r->ids[r->count - 1] != a->ids[i])
+                ac_id_array_push(aTHX_ r, a->ids[i]);
+            i++;
+            j++;
+        }
+    }
+
+    return ret;
+}
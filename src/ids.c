@@ -0,0 +1,101 @@
+#include <EXTERN.h>
+#include <perl.h>
+
+#include "handle.h"
+#include "Compact.h"
+
+/*
+ * Raw node IDs.  An ID is the node's object number, a plain UV, so Perl
+ * code can keep huge numbers of them packed in strings or arrays where a
+ * handle would cost an SV each.  Nothing tracks where IDs are kept: each
+ * new_id and ref_id must be matched by one unref_id, the last of which
+ * destroys the node.
+ *
+ * A node normally moves when put gives it a new key, and its ID changes
+ * with it; ac_id_put returns the new one.  A node whose ID is shared
+ * cannot move, since the other holders would not hear of it, so new keys
+ * on a shared node go in side tables instead.
+ *
+ * Reference counts are kept in ac_id_counts, keyed by the ID's bytes, for
+ * IDs held more than once; an ID missing from it is held once.  While
+ * ac_param_check_ids is set every ID made gets an entry, and IDs without
+ * one are refused, so a stale or made-up ID croaks instead of reaching
+ * whatever object now has that number.  IDs made before checking was
+ * turned on are refused too.
+ */
+
+int ac_param_check_ids = 0;
+
+static HV *ac_id_counts;
+
+static SV **ac_id_count(pTHX_ UV id, int lval)
+{
+    if (!ac_id_counts)
+        ac_id_counts = newHV();
+
+    return hv_fetch(ac_id_counts, (const char *) &id, sizeof(id), lval);
+}
+
+static void ac_id_forget(pTHX_ UV id)
+{
+    (void) hv_delete(ac_id_counts, (const char *) &id, sizeof(id), G_DISCARD);
+}
+
+ac_object ac_id_check(pTHX_ UV id)
+{
+    if (ac_param_check_ids && !ac_id_count(aTHX_ id, 0))
+        croak("Invalid node ID %" UVuf, id);
+
+    return (ac_object) id;
+}
+
+UV ac_id_new(pTHX_ struct ac_template *tpl)
+{
+    UV id = ac_node_new_object(aTHX_ tpl);
+
+    if (ac_param_check_ids)
+        sv_setiv(*ac_id_count(aTHX_ id, 1), 1);
+
+    return id;
+}
+
+UV ac_id_put(pTHX_ UV id, struct ac_key *k, SV *val)
+{
+    SV **countp = ac_id_count(aTHX_ ac_id_check(aTHX_ id), 0);
+    SV *count = countp ? *countp : NULL;
+    UV to = ac_node_store(aTHX_ id, NULL, count && SvIV(count) > 1, k, val);
+
+    if (to != id && count)
+    {
+        (void) hv_store(ac_id_counts, (const char *) &to, sizeof(to),
+                SvREFCNT_inc_simple_NN(count), 0);
+        ac_id_forget(aTHX_ id);
+    }
+
+    return to;
+}
+
+void ac_id_ref(pTHX_ UV id)
+{
+    SV *count = *ac_id_count(aTHX_ ac_id_check(aTHX_ id), 1);
+
+    sv_setiv(count, SvOK(count) ? SvIV(count) + 1 : 2);
+}
+
+void ac_id_unref(pTHX_ UV id)
+{
+    SV **countp = ac_id_count(aTHX_ ac_id_check(aTHX_ id), 0);
+    IV count = (countp ? SvIV(*countp) : 1) - 1;
+
+    if (count > 1 || (count && ac_param_check_ids))
+    {
+        sv_setiv(*countp, count);
+        return;
+    }
+
+    if (countp)
+        ac_id_forget(aTHX_ id);
+
+    if (!count)
+        ac_node_destroy(aTHX_ id);
+}
@@ -0,0 +1,201 @@
+#include <EXTERN.h>
+#include <perl.h>
+
+#include "handle.h"
+#include "Compact.h"
+
+/*
+ * Loading delimited text (CSV, TSV and the like) into nodes of a template's
+ * class.  The input is read in large chunks; each record is split in place
+ * and every cell handed to its field type's scalar_parse, which stores it
+ * straight into the object.  Apart from the node handles themselves (and
+ * whatever an SV-typed field stores), no Perl values are made.
+ *
+ * Cells may be quoted, with the quote doubled inside to stand for itself;
+ * quoted cells may span lines.  An empty cell leaves its field unset.  A
+ * record may have fewer cells than the template has keys, but not more.
+ */
+
+#define AC_LOAD_CHUNK 65536
+
+struct ac_loader
+{
+    struct ac_template *tpl;
+    int sep;                /* as unsigned chars */
+    int quote;              /* or -1 for none */
+    UV line;                /* of the current record, from 1 */
+    SV *cell;               /* unquoting buffer */
+};
+
+#define AC_LOAD_IS(ch, c) ((U8) (ch) == (c))
+
+/*
+ * Find the end of the record starting at p: the newline ending it, or e if
+ * the input is exhausted.  NULL if more input is needed.
+ */
+static const char *ac_load_scan(struct ac_loader *ld, const char *p,
+        const char *e, int eof)
+{
+    int quoted = 0;
+
+    for (; p < e; p++)
+    {
+        if (AC_LOAD_IS(*p, ld->quote))
+            quoted = !quoted;
+        else if (*p == '\n' && !quoted)
+            return p;
+    }
+
+    return eof ? e : NULL;
+}
+
+static void ac_load_cell(pTHX_ struct ac_loader *ld, ac_object o, int i,
+        const char *pv, STRLEN len)
+{
+    struct ac_template *tpl = ld->tpl;
+    struct ac_type *ty;
+
+    if (!len)
+        return;
+
+    if (i >= tpl->nkeys)
+        croak("Line %" UVuf " has more than %d fields", ld->line,
+                tpl->nkeys);
+
+    ty = tpl->keys[i]->type;
+
+    if (!ty->ops->scalar_parse)
+        croak("Cannot load field \"%" SVf "\" from text",
+                SVfARG(tpl->keys[i]->name));
+
+    if (tpl->pbits[i] != AC_ALWAYS_PRESENT)
+        ac_object_store(o, tpl->pbits[i], 1, 1);
+
+    ty->ops->scalar_parse(ty, o, tpl->offsets[i], pv, len);
+}
+
+/* Split the record in [p, e) into cells and store them */
+static void ac_load_record(pTHX_ struct ac_loader *ld, ac_object o,
+        const char *p, const char *e)
+{
+    int i = 0;
+
+    if (e > p && e[-1] == '\r')
+        e--;
+
+    for (;;)
+    {
+        const char *start = p;
+
+        if (p < e && AC_LOAD_IS(*p, ld->quote))
+        {
+            char *cell = SvGROW(ld->cell, (STRLEN) (e - p) + 1);
+            STRLEN len = 0;
+
+            for (p++; p < e; p++)
+            {
+                if (AC_LOAD_IS(*p, ld->quote))
+                {
+                    if (p + 1 < e && AC_LOAD_IS(p[1], ld->quote))
+                        p++;
+                    else
+                        break;
+                }
+
+                cell[len++] = *p;
+            }
+
+            if (p == e || (++p < e && !AC_LOAD_IS(*p, ld->sep)))
+                croak("Line %" UVuf " has a badly quoted field", ld->line);
+
+            ac_load_cell(aTHX_ ld, o, i, cell, len);
+        }
+        else
+        {
+            while (p < e && !AC_LOAD_IS(*p, ld->sep))
+                p++;
+
+            ac_load_cell(aTHX_ ld, o, i, start, p - start);
+        }
+
+        if (p == e)
+            return;
+
+        p++;
+        i++;
+    }
+}
+
+SV *ac_load_delimited(pTHX_ PerlIO *fp, struct ac_template *tpl, int sep,
+        int quote, int header)
+{
+    AV *ret = (AV *) sv_2mortal((SV *) newAV());
+    struct ac_loader ld;
+    SV *bufsv = sv_2mortal(newSV(AC_LOAD_CHUNK));
+    STRLEN size = AC_LOAD_CHUNK, used = 0;
+    char *buf = SvPVX(bufsv);
+    int eof = 0;
+
+    ld.tpl = tpl;
+    ld.sep = sep;
+    ld.quote = quote;
+    ld.line = 1;
+    ld.cell = sv_2mortal(newSV(AC_LOAD_CHUNK));
+
+    while (!eof || used)
+    {
+        const char *p = buf, *e;
+
+        if (!eof)
+        {
+            SSize_t got;
+
+            /* a record longer than the buffer; make room for more */
+            if (used == size)
+            {
+                size *= 2;
+                p = buf = SvGROW(bufsv, size);
+            }
+
+            got = PerlIO_read(fp, buf + used, size - used);
+
+            if (got < 0)
+                croak("Read error: %s", Strerror(errno));
+
+            eof = !got;
+            used += got;
+        }
+
+        while (p < buf + used && (e = ac_load_scan(&ld, p, buf + used, eof)))
+        {
+            if (header)
+            {
+                header = 0;
+            }
+            else if (e > p && !(e == p + 1 && *p == '\r'))
+            {
+                ac_object o = ac_new_object(tpl->cl);
+                SV *handle = ac_rehandle(aTHX_ &ac_hs_node,
+                        INT2PTR(void *, o));
+
+                av_push(ret, newRV_noinc(handle));
+                ac_load_record(aTHX_ &ld, o, p, e);
+            }
+
+            for (; p < e; p++)
+                if (*p == '\n')
+                    ld.line++;
+
+            p = e < buf + used ? e + 1 : e;
+            ld.line++;
+        }
+
+        Move(p, buf, buf + used - p, char);
+        used -= p - buf;
+
+        if (eof && used)
+            croak("internal error: unparsed input at end of file");
+    }
+
+    return newRV_inc((SV *) ret);
+}
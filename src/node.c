@@ -0,0 +1,1240 @@
+#include <EXTERN.h>
+#include <perl.h>
+
+#include "handle.h"
+#include "Compact.h"
+
+/*
+ * Nodes and shapes.  A node is a schemaless object: any key can be put on
+ * it.  Since a class has a single fixed type, a node which gains or loses a
+ * key has to move to a different class.  The classes are organized as a
+ * tree of shapes (what other VMs call hidden classes or maps): the root
+ * shape has no fields, and each child adds one key to its parent's.  A shape
+ * holds the record type and class for its keys, and the field offsets.
+ *
+ * Every shape keeps a table of transitions, so that moving a node to the
+ * shape with one more key is a single probe once the move has been made
+ * before.  Nodes which gain fields in the same order share a path through
+ * the tree; different orders give different shapes (and classes), which is
+ * the price for not having to canonicalize on every transition.
+ *
+ * Node fields are optional record fields, so deleting a key only clears its
+ * presence bit, and putting it back sets the bit again; neither moves the
+ * node.  A node thus never goes back up the tree.
+ *
+ * Shapes are never freed.  TODO: a shape with no objects and no children
+ * could go, taking its class's pages with it.
+ *
+ * Optional attributes make the tree bushy: every combination is a shape,
+ * and every shape costs at least a page.  So a key can instead be made
+ * sparse in a shape, which stores it in a side table on the shape (keyed
+ * by object) without any migration.  That happens automatically when a
+ * shape already has ac_param_sparse_children children, when there are
+ * ac_param_sparse_shapes shapes in all, or when the established transition
+ * for a key leads to a shape with less than 1/ac_param_sparse_ratio of the
+ * population of this one.  Sparse keys are inherited by child shapes, and
+ * follow nodes through migrations.
+ */
+
+int ac_param_sparse_children = 8;
+int ac_param_sparse_shapes = 1024;
+int ac_param_sparse_ratio = 32;
+
+/* Don't judge ratios on tiny populations */
+#define AC_SPARSE_MIN_POP 64
+
+struct ac_side_table
+{
+    struct ac_key *key;
+    int shift;              /* 1 << shift slots, or none if 0 */
+    UV used;
+    ac_object *objs;
+    SV **vals;
+    int overflow;           /* only for fixed nodes, which cannot migrate */
+};
+
+struct ac_shape_edge
+{
+    struct ac_key *key;
+    struct ac_shape *to;
+};
+
+struct ac_shape
+{
+    struct ac_shape *parent;
+    struct ac_key *key;     /* added by the edge from the parent */
+
+    int nkeys;
+    struct ac_key **keys;   /* root to here */
+    UV *offsets;            /* of each key's field */
+    UV *pbits;              /* and its presence bit */
+    SV **names;             /* shared-HEK copies of key names, or NULL */
+
+    struct ac_type *dtype;
+    struct ac_class *cl;
+
+    struct ac_shape_edge *edges;
+    int nedges;
+    int edge_shift;         /* the table has 1 << edge_shift slots */
+    int nchildren;
+
+    struct ac_side_table *sparse;
+    int nsparse;
+};
+
+static HV *ac_node_stash;
+static struct ac_shape *ac_root_shape;
+static UV ac_shape_count;
+
+/*
+ * Side tables: open addressing on the object, linear probing, deletion by
+ * backward shifting.  Values are owned SVs.
+ */
+
+static UV ac_side_hash(ac_object o, int shift)
+{
+    return ((o * 0x9E3779B9UL) & 0xFFFFFFFFUL) >> (32 - shift);
+}
+
+static SV **ac_side_find(struct ac_side_table *st, ac_object o)
+{
+    UV mask, ix;
+
+    if (!st->shift)
+        return NULL;
+
+    mask = ((UV)1 << st->shift) - 1;
+
+    for (ix = ac_side_hash(o, st->shift); st->objs[ix]; ix = (ix + 1) & mask)
+        if (st->objs[ix] == o)
+            return &st->vals[ix];
+
+    return NULL;
+}
+
+static void ac_side_insert(struct ac_side_table *st, ac_object o, SV *val)
+{
+    UV mask = ((UV)1 << st->shift) - 1;
+    UV ix;
+
+    for (ix = ac_side_hash(o, st->shift); st->objs[ix]; ix = (ix + 1) & mask)
+        ;
+
+    st->objs[ix] = o;
+    st->vals[ix] = val;
+    st->used++;
+}
+
+static void ac_side_store(struct ac_side_table *st, ac_object o, SV *val)
+{
+    if (!st->shift || 2 * (st->used + 1) > ((UV)1 << st->shift))
+    {
+        ac_object *oldo = st->objs;
+        SV **oldv = st->vals;
+        UV oldsize = st->shift ? (UV)1 << st->shift : 0;
+        UV i;
+
+        st->shift = st->shift ? st->shift + 1 : 3;
+        Newxz(st->objs, (UV)1 << st->shift, ac_object);
+        Newx(st->vals, (UV)1 << st->shift, SV *);
+        st->used = 0;
+
+        for (i = 0; i < oldsize; i++)
+            if (oldo[i])
+                ac_side_insert(st, oldo[i], oldv[i]);
+
+        Safefree(oldo);
+        Safefree(oldv);
+    }
+
+    ac_side_insert(st, o, val);
+}
+
+/* Returns the value, which the caller now owns, or NULL */
+static SV *ac_side_remove(struct ac_side_table *st, ac_object o)
+{
+    SV **svp = ac_side_find(st, o);
+    UV mask, hole, ix;
+    SV *ret;
+
+    if (!svp)
+        return NULL;
+
+    ret = *svp;
+    mask = ((UV)1 << st->shift) - 1;
+    hole = svp - st->vals;
+    st->objs[hole] = 0;
+    st->used--;
+
+    /* Pull back any later entries which would now be unreachable */
+    for (ix = (hole + 1) & mask; st->objs[ix]; ix = (ix + 1) & mask)
+    {
+        UV home = ac_side_hash(st->objs[ix], st->shift);
+
+        if (((ix - home) & mask) >= ((ix - hole) & mask))
+        {
+            st->objs[hole] = st->objs[ix];
+            st->vals[hole] = st->vals[ix];
+            st->objs[ix] = 0;
+            hole = ix;
+        }
+    }
+
+    return ret;
+}
+
+/* Store val for o, checked and converted as the key's type would. */
+static void ac_side_put(pTHX_ struct ac_side_table *st, ac_object o, SV *val)
+{
+    struct ac_type *ty = st->key->type;
+    SV **svp = ac_side_find(st, o);
+    SV *sv = svp ? *svp : sv_newmortal();
+
+    if (ty->ops->scalar_normalize)
+        ty->ops->scalar_normalize(ty, val, sv);
+    else
+        sv_setsv(sv, val);
+
+    if (!svp)
+        ac_side_store(st, o, SvREFCNT_inc_simple_NN(sv));
+}
+
+static struct ac_side_table *ac_shape_sparse(struct ac_shape *sh,
+        struct ac_key *k, int create)
+{
+    int i;
+
+    for (i = 0; i < sh->nsparse; i++)
+        if (sh->sparse[i].key == k)
+            return &sh->sparse[i];
+
+    if (!create)
+        return NULL;
+
+    Renew(sh->sparse, sh->nsparse + 1, struct ac_side_table);
+    Zero(&sh->sparse[sh->nsparse], 1, struct ac_side_table);
+    sh->sparse[sh->nsparse].key = k;
+    SvREFCNT_inc(k->reflection);
+    k->fixed = 1;
+
+    return &sh->sparse[sh->nsparse++];
+}
+
+/*
+ * Node handles are blessed into their class's stash, at once or, while
+ * ac_param_lazy_bless is set, only when Perl looks (see ops.c).
+ */
+int ac_param_lazy_bless = 0;
+
+static void ac_setup_node_handle(pTHX_ SV *handle, void *obj)
+{
+    SV *rv;
+
+    if (ac_param_lazy_bless)
+        return;
+
+    rv = sv_2mortal(newRV_inc(handle));
+    sv_bless(rv, ac_class_of(PTR2UV(obj))->stash);
+}
+
+void ac_node_bless(pTHX_ SV *ref)
+{
+    void *obj;
+
+    if (!SvROK(ref) || SvOBJECT(SvRV(ref)) ||
+            !(obj = ac_unhandle(aTHX_ &ac_hs_node, SvRV(ref), NULL, NULL)))
+        return;
+
+    sv_bless(ref, ac_class_of(PTR2UV(obj))->stash);
+}
+
+void ac_node_destroy(pTHX_ ac_object o)
+{
+    struct ac_shape *sh = ac_class_of(o)->shape;
+    int i;
+
+    for (i = 0; i < sh->nsparse; i++)
+        SvREFCNT_dec(ac_side_remove(&sh->sparse[i], o));
+
+    ac_free_handle(aTHX_ INT2PTR(void *, o));
+}
+
+static void ac_free_node_handle(pTHX_ void *op)
+{
+    ac_node_destroy(aTHX_ PTR2UV(op));
+}
+
+AC_DEFINE_HANDLE_SORT(hs_node, ac_setup_node_handle, ac_free_node_handle);
+
+/*
+ * Keys are hash-consed, so that each name has one key.  The table maps
+ * names to keys without owning them: a key leaves it when its handle dies,
+ * which is once no shape, template or Perl code uses it.
+ */
+static HV *ac_key_table;
+
+static void ac_delete_key(pTHX_ void *kp)
+{
+    struct ac_key *k = (struct ac_key *) kp;
+
+    if (PL_phase != PERL_PHASE_DESTRUCT)
+        (void) hv_delete_ent(ac_key_table, k->name, G_DISCARD, 0);
+
+    SvREFCNT_dec(k->name);
+    SvREFCNT_dec(k->type->reflection);
+    Safefree(k);
+}
+
+AC_DEFINE_HANDLE_SORT(hs_key, 0, ac_delete_key);
+
+/* Transition tables: open addressing on the key pointer, linear probing */
+
+static UV ac_edge_hash(struct ac_key *k, int shift)
+{
+    return (((PTR2UV(k) >> 3) * 0x9E3779B9UL) & 0xFFFFFFFFUL) >> (32 - shift);
+}
+
+static struct ac_shape *ac_edge_find(struct ac_shape *sh, struct ac_key *k)
+{
+    UV mask, ix;
+
+    if (!sh->edges)
+        return NULL;
+
+    mask = ((UV)1 << sh->edge_shift) - 1;
+
+    for (ix = ac_edge_hash(k, sh->edge_shift); sh->edges[ix].key;
+            ix = (ix + 1) & mask)
+        if (sh->edges[ix].key == k)
+            return sh->edges[ix].to;
+
+    return NULL;
+}
+
+static void ac_edge_insert(struct ac_shape *sh, struct ac_key *k,
+        struct ac_shape *to)
+{
+    UV mask = ((UV)1 << sh->edge_shift) - 1;
+    UV ix;
+
+    for (ix = ac_edge_hash(k, sh->edge_shift); sh->edges[ix].key;
+            ix = (ix + 1) & mask)
+        ;
+
+    sh->edges[ix].key = k;
+    sh->edges[ix].to = to;
+    sh->nedges++;
+}
+
+static void ac_edge_add(struct ac_shape *sh, struct ac_key *k,
+        struct ac_shape *to)
+{
+    /* Keep the table at most half full */
+    if (!sh->edges || 2 * (sh->nedges + 1) > (1 << sh->edge_shift))
+    {
+        struct ac_shape_edge *old = sh->edges;
+        int oldsize = old ? 1 << sh->edge_shift : 0;
+        int i;
+
+        sh->edge_shift = old ? sh->edge_shift + 1 : 2;
+        Newxz(sh->edges, 1 << sh->edge_shift, struct ac_shape_edge);
+        sh->nedges = 0;
+
+        for (i = 0; i < oldsize; i++)
+            if (old[i].key)
+                ac_edge_insert(sh, old[i].key, old[i].to);
+
+        Safefree(old);
+    }
+
+    ac_edge_insert(sh, k, to);
+}
+
+static struct ac_shape *ac_shape_new(pTHX_ struct ac_shape *parent,
+        struct ac_key *k)
+{
+    struct ac_shape *sh;
+    struct ac_field_spec *spec;
+    int i;
+
+    Newxz(sh, 1, struct ac_shape);
+    sh->parent = parent;
+    sh->key = k;
+    sh->nkeys = parent ? parent->nkeys + 1 : 0;
+
+    Newx(sh->keys, sh->nkeys ? sh->nkeys : 1, struct ac_key *);
+    Newx(sh->offsets, sh->nkeys ? sh->nkeys : 1, UV);
+    Newx(sh->pbits, sh->nkeys ? sh->nkeys : 1, UV);
+    Newxz(spec, sh->nkeys ? sh->nkeys : 1, struct ac_field_spec);
+
+    if (parent)
+    {
+        Copy(parent->keys, sh->keys, parent->nkeys, struct ac_key *);
+        sh->keys[sh->nkeys - 1] = k;
+        SvREFCNT_inc(k->reflection);
+        k->fixed = 1;
+
+        for (i = 0; i < parent->nsparse; i++)
+            if (parent->sparse[i].key != k)
+                ac_shape_sparse(sh, parent->sparse[i].key, 1)->overflow =
+                    parent->sparse[i].overflow;
+    }
+
+    ac_shape_count++;
+
+    for (i = 0; i < sh->nkeys; i++)
+    {
+        spec[i].name = SvPV(sh->keys[i]->name, spec[i].namelen);
+        spec[i].type = sh->keys[i]->type;
+        spec[i].flags = AC_FIELD_OPTIONAL | sh->keys[i]->layout_flags;
+        spec[i].weight = sh->keys[i]->weight;
+    }
+
+    sh->dtype = ac_make_record_type_spec(sh->nkeys, spec);
+    Safefree(spec);
+
+    /* The class holds the type now */
+    sh->cl = ac_new_class(sh->dtype, sh->dtype->inline_size, AC_LIFE_PERL,
+            NULL, ac_node_stash);
+    SvREFCNT_dec(sh->dtype->reflection);
+    sh->cl->shape = sh;
+
+    /* Work out the layout once, rather than on every migration */
+    for (i = 0; i < sh->nkeys; i++)
+    {
+        ac_record_locate(sh->dtype, sh->keys[i]->name, &sh->offsets[i],
+                &sh->pbits[i]);
+    }
+
+    return sh;
+}
+
+static struct ac_shape *ac_shape_root(pTHX)
+{
+    if (!ac_root_shape)
+    {
+        ac_node_stash = gv_stashpvs("Arena::Compact::Node", GV_ADD);
+        ac_root_shape = ac_shape_new(aTHX_ NULL, NULL);
+    }
+
+    return ac_root_shape;
+}
+
+static struct ac_shape *ac_shape_add(pTHX_ struct ac_shape *sh,
+        struct ac_key *k)
+{
+    struct ac_shape *to = ac_edge_find(sh, k);
+
+    if (!to)
+    {
+        to = ac_shape_new(aTHX_ sh, k);
+        ac_edge_add(sh, k, to);
+        sh->nchildren++;
+    }
+
+    return to;
+}
+
+/* Should a key not yet on this shape be added as a sparse key? */
+static int ac_shape_wants_sparse(struct ac_shape *sh, struct ac_key *k)
+{
+    struct ac_shape *to = ac_edge_find(sh, k);
+
+    if (to)
+        return sh->cl->used_objects >= AC_SPARSE_MIN_POP &&
+            to->cl->used_objects * ac_param_sparse_ratio <
+                sh->cl->used_objects;
+
+    return sh->nchildren >= ac_param_sparse_children ||
+        ac_shape_count >= (UV) ac_param_sparse_shapes;
+}
+
+/*
+ * The side table to keep k in for o, a node on sh without the key as a
+ * field, or NULL if o should migrate.  A fixed node cannot migrate, but its
+ * keys go in a table of their own kind: other nodes still migrate past it
+ * (unless they already have an entry there), so one fixed node does not
+ * make the key sparse for the whole shape.
+ */
+static struct ac_side_table *ac_node_side(struct ac_shape *sh,
+        struct ac_key *k, ac_object o, int fixed)
+{
+    struct ac_side_table *st = ac_shape_sparse(sh, k, 0);
+
+    if (st && (!st->overflow || fixed || ac_side_find(st, o)))
+        return st;
+
+    if (ac_shape_wants_sparse(sh, k))
+    {
+        st = ac_shape_sparse(sh, k, 1);
+        st->overflow = 0;
+        return st;
+    }
+
+    if (!fixed)
+        return NULL;
+
+    st = ac_shape_sparse(sh, k, 1);
+    st->overflow = 1;
+
+    return st;
+}
+
+#define AC_NODE_PRESENT(o, pbit) \
+    ((pbit) == AC_ALWAYS_PRESENT || ac_object_fetch((o), (pbit), 1))
+
+static int ac_shape_index(struct ac_shape *sh, struct ac_key *k)
+{
+    int i;
+
+    for (i = 0; i < sh->nkeys; i++)
+        if (sh->keys[i] == k)
+            return i;
+
+    return -1;
+}
+
+/*
+ * Move a node to another shape.  Fields common to both are moved bitwise;
+ * fields the new shape lacks are destroyed.  The handle, if any, follows
+ * the node.
+ */
+static ac_object ac_node_migrate(pTHX_ SV *handle, ac_object o,
+        struct ac_shape *to)
+{
+    struct ac_shape *from = ac_class_of(o)->shape;
+    ac_object n = ac_new_object(to->cl);
+    UV chunk = sizeof(UV) * CHAR_BIT;
+    int i;
+
+    for (i = 0; i < from->nkeys; i++)
+    {
+        struct ac_type *fty = from->keys[i]->type;
+        int j = ac_shape_index(to, from->keys[i]);
+        UV bit;
+
+        if (!AC_NODE_PRESENT(o, from->pbits[i]))
+            continue;
+
+        if (j < 0)
+        {
+            if (fty->flags & AC_DESTROY_USED)
+                fty->ops->destroy(fty, o, from->offsets[i]);
+            continue;
+        }
+
+        if (to->pbits[j] != AC_ALWAYS_PRESENT)
+            ac_object_store(n, to->pbits[j], 1, 1);
+
+        for (bit = 0; bit < fty->inline_size; bit += chunk)
+        {
+            UV len = fty->inline_size - bit < chunk ?
+                fty->inline_size - bit : chunk;
+
+            ac_object_store(n, to->offsets[j] + bit, len,
+                    ac_object_fetch(o, from->offsets[i] + bit, len));
+        }
+
+        if (fty->flags & AC_TRANSLOCATE_USED)
+            fty->ops->translocate(fty, o, n, to->offsets[j]);
+    }
+
+    for (i = 0; i < from->nsparse; i++)
+    {
+        struct ac_key *k = from->sparse[i].key;
+        SV *val = ac_side_remove(&from->sparse[i], o);
+        int j;
+
+        if (!val)
+            continue;
+
+        j = ac_shape_index(to, k);
+
+        if (j >= 0)
+        {
+            if (to->pbits[j] != AC_ALWAYS_PRESENT)
+                ac_object_store(n, to->pbits[j], 1, 1);
+            k->type->ops->scalar_put(k->type, n, to->offsets[j], val);
+            SvREFCNT_dec(val);
+        }
+        else
+        {
+            ac_side_store(ac_shape_sparse(to, k, 1), n, val);
+        }
+    }
+
+    ac_release_object(o);
+
+    if (handle)
+        ac_rehome_handle(aTHX_ &ac_hs_node, handle, INT2PTR(void *, n));
+
+    return n;
+}
+
+ac_object ac_node_new_object(pTHX_ struct ac_template *tpl)
+{
+    return ac_new_object(tpl ? tpl->cl : ac_shape_root(aTHX)->cl);
+}
+
+SV *ac_node_new(pTHX)
+{
+    ac_object o = ac_node_new_object(aTHX_ NULL);
+
+    return newRV_noinc(ac_rehandle(aTHX_ &ac_hs_node, INT2PTR(void *, o)));
+}
+
+ac_object ac_node_unhandle(pTHX_ SV *ref, SV **handlep)
+{
+    if (!SvROK(ref))
+        croak("node handle must be a reference");
+
+    if (handlep)
+        *handlep = SvRV(ref);
+
+    return PTR2UV(ac_unhandle(aTHX_ &ac_hs_node, SvRV(ref), NULL,
+                "node handle has incorrect magic"));
+}
+
+/* The key takes over the caller's reference to ty; NULL means an SV. */
+static struct ac_key *ac_key_new(pTHX_ SV *name, struct ac_type *ty)
+{
+    struct ac_key *k;
+
+    Newxz(k, 1, struct ac_key);
+    k->name = newSVsv(name);
+    k->type = ty ? ty : ac_make_sv_type();
+    k->typed = ty != NULL;
+    k->reflection = ac_rehandle(aTHX_ &ac_hs_key, k);
+
+    if (!ac_key_table)
+        ac_key_table = newHV();
+
+    (void) hv_store_ent(ac_key_table, k->name, newSViv(PTR2IV(k)), 0);
+
+    return k;
+}
+
+/*
+ * Give an untyped, unused key a type, taking over the caller's reference.
+ * Returns 0, leaving the key alone, if it is too late.
+ */
+static int ac_key_set_type(pTHX_ struct ac_key *k, struct ac_type *ty)
+{
+    if (k->typed || k->fixed)
+        return 0;
+
+    SvREFCNT_dec(k->type->reflection);
+    k->type = ty;
+    k->typed = 1;
+
+    return 1;
+}
+
+/*
+ * A reference to the key for name, made if need be.  If ty is given (the
+ * key takes over the caller's reference) it must be the key's type, or the
+ * key must still be free to take it.  Types are canonical, so comparing
+ * them is comparing pointers.
+ */
+SV *ac_key(pTHX_ SV *name, struct ac_type *ty)
+{
+    HE *he = ac_key_table ? hv_fetch_ent(ac_key_table, name, 0, 0) : NULL;
+    struct ac_key *k;
+
+    if (!he)
+        return newRV_noinc(ac_key_new(aTHX_ name, ty)->reflection);
+
+    k = INT2PTR(struct ac_key *, SvIVX(HeVAL(he)));
+
+    if (ty && ty != k->type && !ac_key_set_type(aTHX_ k, ty))
+    {
+        SV *has = sv_2mortal(newSVpvs(""));
+
+        SvREFCNT_dec(ty->reflection);
+        k->type->ops->deparse(k->type, has);
+        croak("Key \"%" SVf "\" already exists with type %" SVf,
+                SVfARG(k->name), SVfARG(has));
+    }
+    else if (ty && ty == k->type)
+    {
+        SvREFCNT_dec(ty->reflection);
+    }
+
+    return newRV_inc(k->reflection);
+}
+
+struct ac_key *ac_key_unhandle(pTHX_ SV *ref)
+{
+    if (!SvROK(ref))
+        croak("key handle must be a reference");
+
+    return (struct ac_key *) ac_unhandle(aTHX_ &ac_hs_key, SvRV(ref), NULL,
+            "key handle has incorrect magic");
+}
+
+/*
+ * The key for a name.  A new key is only held by its handle until something
+ * uses it, so the handle is kept alive with the caller's temporaries.
+ */
+struct ac_key *ac_key_intern(pTHX_ SV *name)
+{
+    return ac_key_unhandle(aTHX_ sv_2mortal(ac_key(aTHX_ name, NULL)));
+}
+
+static void ac_delete_template(pTHX_ void *tp)
+{
+    struct ac_template *tpl = (struct ac_template *) tp;
+    int i;
+
+    for (i = 0; i < tpl->nkeys; i++)
+        SvREFCNT_dec(tpl->keys[i]->reflection);
+
+    Safefree(tpl->keys);
+    Safefree(tpl->offsets);
+    Safefree(tpl->pbits);
+    Safefree(tpl);
+}
+
+AC_DEFINE_HANDLE_SORT(hs_template, 0, ac_delete_template);
+
+/*
+ * Templates always take the dense path: the caller has told us which keys
+ * go together, which is better evidence than the sparse heuristics have.
+ */
+SV *ac_template_new(pTHX_ struct ac_key **keys, int count)
+{
+    struct ac_shape *sh = ac_shape_root(aTHX);
+    struct ac_template *tpl;
+    int i, j;
+
+    for (i = 0; i < count; i++)
+    {
+        if (ac_shape_index(sh, keys[i]) >= 0)
+            croak("Key \"%" SVf "\" appears twice in template",
+                    SVfARG(keys[i]->name));
+
+        sh = ac_shape_add(aTHX_ sh, keys[i]);
+    }
+
+    Newxz(tpl, 1, struct ac_template);
+    tpl->cl = sh->cl;
+    tpl->nkeys = count;
+    Newx(tpl->keys, count + 1, struct ac_key *);
+    Newx(tpl->offsets, count + 1, UV);
+    Newx(tpl->pbits, count + 1, UV);
+
+    for (i = 0; i < count; i++)
+    {
+        j = ac_shape_index(sh, keys[i]);
+        tpl->keys[i] = keys[i];
+        tpl->offsets[i] = sh->offsets[j];
+        tpl->pbits[i] = sh->pbits[j];
+        SvREFCNT_inc(keys[i]->reflection);
+    }
+
+    tpl->reflection = ac_rehandle(aTHX_ &ac_hs_template, tpl);
+
+    return newRV_noinc(tpl->reflection);
+}
+
+struct ac_template *ac_template_unhandle(pTHX_ SV *ref)
+{
+    if (!SvROK(ref))
+        croak("template handle must be a reference");
+
+    return (struct ac_template *) ac_unhandle(aTHX_ &ac_hs_template,
+            SvRV(ref), NULL, "template handle has incorrect magic");
+}
+
+/* Values past the end of vals leave their fields unset. */
+SV *ac_node_new_from_template(pTHX_ struct ac_template *tpl, SV **vals,
+        int count)
+{
+    ac_object o;
+    SV *ref;
+    int i;
+
+    if (count > tpl->nkeys)
+        croak("Template has %d keys but %d values were given", tpl->nkeys,
+                count);
+
+    /* The handle comes first, so a value refused below frees the node */
+    o = ac_new_object(tpl->cl);
+    ref = sv_2mortal(newRV_noinc(ac_rehandle(aTHX_ &ac_hs_node,
+                    INT2PTR(void *, o))));
+
+    for (i = 0; i < count; i++)
+    {
+        ac_do_set(tpl->keys[i]->type, o, tpl->offsets[i], vals[i]);
+
+        if (tpl->pbits[i] != AC_ALWAYS_PRESENT)
+            ac_object_store(o, tpl->pbits[i], 1, 1);
+    }
+
+    return SvREFCNT_inc_simple_NN(ref);
+}
+
+/*
+ * Find a key's field in a class, via the key's inline cache.  This skips
+ * both the name comparisons and the subobject call whenever the key is used
+ * on the same few classes over and over, which is the usual case.  Misses
+ * replace entries round robin.
+ */
+static struct ac_type *ac_key_lookup(pTHX_ struct ac_key *k,
+        struct ac_class *cl, UV *offp, UV *pbitp)
+{
+    struct ac_key_ic *ic;
+    int i;
+
+    for (i = 0; i < AC_KEY_IC_SIZE; i++)
+    {
+        if (k->ic[i].cl == cl)
+        {
+            *offp = k->ic[i].off;
+            *pbitp = k->ic[i].pbit;
+            return k->ic[i].ty;
+        }
+    }
+
+    ic = &k->ic[k->ic_next];
+    k->ic_next = (k->ic_next + 1) % AC_KEY_IC_SIZE;
+    ic->cl = cl;
+    ic->off = ic->pbit = 0;
+    ic->ty = ac_record_locate(cl->dtype, k->name, &ic->off, &ic->pbit);
+
+    *offp = ic->off;
+    *pbitp = ic->pbit;
+    return ic->ty;
+}
+
+void ac_node_get(pTHX_ ac_object o, struct ac_key *k, SV *ret)
+{
+    UV off, pbit;
+    struct ac_class *cl = ac_class_of(o);
+    struct ac_type *ty = ac_key_lookup(aTHX_ k, cl, &off, &pbit);
+    struct ac_side_table *st;
+    SV **svp;
+
+    if (ty && AC_NODE_PRESENT(o, pbit))
+    {
+        ac_do_get(ty, o, off, ret);
+        return;
+    }
+
+    if (!(st = ac_shape_sparse(cl->shape, k, 0)) ||
+            !(svp = ac_side_find(st, o)))
+        croak("Field \"%" SVf "\" not found", SVfARG(k->name));
+
+    sv_setsv(ret, *svp);
+}
+
+/*
+ * Refuse a value k's type would refuse, before anything is changed for it:
+ * adding a field initializes it and sets its presence bit, and the node may
+ * have to move first.
+ */
+static void ac_key_check(pTHX_ struct ac_key *k, SV *val)
+{
+    if (k->type->ops->scalar_normalize)
+        k->type->ops->scalar_normalize(k->type, val, sv_newmortal());
+}
+
+/*
+ * Store into o, returning where the node now is.  The handle, if any,
+ * follows it when it changes shape; a fixed node never moves, and keeps a
+ * key its shape lacks in a side table instead.
+ */
+ac_object ac_node_store(pTHX_ ac_object o, SV *handle, int fixed,
+        struct ac_key *k, SV *val)
+{
+    struct ac_class *cl = ac_class_of(o);
+    UV off, pbit;
+    struct ac_type *ty = ac_key_lookup(aTHX_ k, cl, &off, &pbit);
+
+    if (!ty)
+    {
+        struct ac_side_table *st = ac_node_side(cl->shape, k, o, fixed);
+
+        if (st)
+        {
+            ac_side_put(aTHX_ st, o, val);
+            return o;
+        }
+
+        ac_key_check(aTHX_ k, val);
+        o = ac_node_migrate(aTHX_ handle, o, ac_shape_add(aTHX_ cl->shape, k));
+        cl = ac_class_of(o);
+        ty = ac_key_lookup(aTHX_ k, cl, &off, &pbit);
+    }
+    else if (!AC_NODE_PRESENT(o, pbit))
+    {
+        ac_key_check(aTHX_ k, val);
+    }
+
+    if (!AC_NODE_PRESENT(o, pbit))
+        ac_child_add(cl->dtype, o, 0, k->name);
+
+    ac_do_set(ty, o, off, val);
+
+    return o;
+}
+
+void ac_node_put(pTHX_ SV *handle, struct ac_key *k, SV *val)
+{
+    ac_node_store(aTHX_
+            PTR2UV(ac_unhandle(aTHX_ &ac_hs_node, handle, NULL, NULL)),
+            handle, 0, k, val);
+}
+
+/*
+ * Set several fields at once.  The final shape is found by walking the
+ * transition edges for each new key first, so the node moves at most once
+ * no matter how many keys are added; keys bound for side tables are decided
+ * against the shape the node will end up in.  All values are checked
+ * against their keys' types before anything is stored.
+ */
+void ac_node_put_many(pTHX_ SV *handle, struct ac_key **keys, SV **vals,
+        int count)
+{
+    ac_object o = PTR2UV(ac_unhandle(aTHX_ &ac_hs_node, handle, NULL, NULL));
+    struct ac_class *cl = ac_class_of(o);
+    struct ac_shape *to = cl->shape;
+    int i;
+
+    /* Check every value first, so a bad one leaves the node as it was */
+    for (i = 0; i < count; i++)
+        ac_key_check(aTHX_ keys[i], vals[i]);
+
+    for (i = 0; i < count; i++)
+    {
+        if (ac_shape_index(to, keys[i]) >= 0 ||
+                ac_node_side(to, keys[i], o, 0))
+            continue;
+
+        to = ac_shape_add(aTHX_ to, keys[i]);
+    }
+
+    if (to != cl->shape)
+    {
+        o = ac_node_migrate(aTHX_ handle, o, to);
+        cl = to->cl;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        UV off, pbit;
+        struct ac_type *ty = ac_key_lookup(aTHX_ keys[i], cl, &off, &pbit);
+
+        if (ty)
+        {
+            if (!AC_NODE_PRESENT(o, pbit))
+                ac_child_add(cl->dtype, o, 0, keys[i]->name);
+
+            ac_do_set(ty, o, off, vals[i]);
+            continue;
+        }
+
+        ac_side_put(aTHX_ ac_shape_sparse(to, keys[i], 1), o, vals[i]);
+    }
+}
+
+int ac_node_exists(pTHX_ ac_object o, struct ac_key *k)
+{
+    struct ac_class *cl = ac_class_of(o);
+    struct ac_side_table *st;
+    UV off, pbit;
+
+    if (ac_key_lookup(aTHX_ k, cl, &off, &pbit) && AC_NODE_PRESENT(o, pbit))
+        return 1;
+
+    return (st = ac_shape_sparse(cl->shape, k, 0)) && ac_side_find(st, o);
+}
+
+/*
+ * Name-based lookup and iteration, for views which deal in strings rather
+ * than key handles.  Only keys the node's shape knows about are found: the
+ * dense keys and the shape's sparse keys, set on this node or not.
+ */
+struct ac_key *ac_node_key_named(pTHX_ ac_object o, SV *name)
+{
+    struct ac_shape *sh = ac_class_of(o)->shape;
+    int i;
+
+    for (i = 0; i < sh->nkeys; i++)
+        if (sv_eq(sh->keys[i]->name, name))
+            return sh->keys[i];
+
+    for (i = 0; i < sh->nsparse; i++)
+        if (sv_eq(sh->sparse[i].key->name, name))
+            return sh->sparse[i].key;
+
+    return NULL;
+}
+
+/*
+ * The first key set on the node at or after position *posp, which is then
+ * moved past it; NULL at the end.  Dense keys come first, in shape order,
+ * then sparse ones.  Keys a node gains during iteration may or may not be
+ * seen, as with Perl hashes.
+ */
+struct ac_key *ac_node_next_key(pTHX_ ac_object o, UV *posp)
+{
+    struct ac_shape *sh = ac_class_of(o)->shape;
+
+    for (; *posp < (UV) sh->nkeys; (*posp)++)
+        if (AC_NODE_PRESENT(o, sh->pbits[*posp]))
+            return sh->keys[(*posp)++];
+
+    for (; *posp < (UV) (sh->nkeys + sh->nsparse); (*posp)++)
+    {
+        struct ac_side_table *st = &sh->sparse[*posp - sh->nkeys];
+
+        if (ac_side_find(st, o))
+        {
+            (*posp)++;
+            return st->key;
+        }
+    }
+
+    return NULL;
+}
+
+void ac_node_delete(pTHX_ ac_object o, struct ac_key *k)
+{
+    struct ac_class *cl = ac_class_of(o);
+    struct ac_side_table *st;
+    UV off, pbit;
+    SV *val;
+
+    if (ac_key_lookup(aTHX_ k, cl, &off, &pbit) && AC_NODE_PRESENT(o, pbit))
+    {
+        ac_child_delete(cl->dtype, o, 0, k->name);
+        return;
+    }
+
+    val = (st = ac_shape_sparse(cl->shape, k, 0)) ? ac_side_remove(st, o) :
+        NULL;
+
+    if (!val)
+        croak("Field \"%" SVf "\" not found", SVfARG(k->name));
+
+    SvREFCNT_dec(val);
+}
+
+/*
+ * Bulk import of hashes.  Each record's values are copied straight from its
+ * hash entries; the only Perl calls are to key(), once per distinct name.
+ *
+ * With a template, every record is allocated in the template's class and
+ * its fields are fetched by precomputed hash; names the template lacks are
+ * put afterwards, as put would.  Without one, each record's names are
+ * sorted, so that records with the same names share a shape whatever order
+ * their hashes iterate in, and stored with put_many.
+ */
+struct ac_import_pair
+{
+    struct ac_key *key;
+    SV *val;
+};
+
+static int ac_import_cmp(const void *a, const void *b)
+{
+    dTHX;
+
+    return sv_cmp(((const struct ac_import_pair *) a)->key->name,
+            ((const struct ac_import_pair *) b)->key->name);
+}
+
+/* Name to key, through a per-import cache which holds the keys alive */
+static struct ac_key *ac_import_key(pTHX_ HV *cache, SV *name)
+{
+    HE *he = hv_fetch_ent(cache, name, 0, 0);
+    struct ac_key *k;
+
+    if (he)
+        return ac_key_unhandle(aTHX_ HeVAL(he));
+
+    k = ac_key_intern(aTHX_ name);
+    hv_store_ent(cache, name, newRV_inc(k->reflection), 0);
+
+    return k;
+}
+
+static void ac_import_fixed(pTHX_ SV *handle, HV *hv,
+        struct ac_template *tpl, U32 *hashes, HV *cache)
+{
+    ac_object o = PTR2UV(ac_unhandle(aTHX_ &ac_hs_node, handle, NULL, NULL));
+    I32 found = 0;
+    HE *he;
+    int i;
+
+    for (i = 0; i < tpl->nkeys; i++)
+    {
+        if (!(he = hv_fetch_ent(hv, tpl->keys[i]->name, 0, hashes[i])))
+            continue;
+
+        ac_do_set(tpl->keys[i]->type, o, tpl->offsets[i], HeVAL(he));
+
+        if (tpl->pbits[i] != AC_ALWAYS_PRESENT)
+            ac_object_store(o, tpl->pbits[i], 1, 1);
+
+        found++;
+    }
+
+    if (found == (I32) HvUSEDKEYS(hv))
+        return;
+
+    hv_iterinit(hv);
+
+    while ((he = hv_iternext(hv)))
+    {
+        struct ac_key *k = ac_import_key(aTHX_ cache, hv_iterkeysv(he));
+
+        for (i = 0; i < tpl->nkeys; i++)
+            if (tpl->keys[i] == k)
+                break;
+
+        if (i == tpl->nkeys)
+            ac_node_put(aTHX_ handle, k, HeVAL(he));
+    }
+}
+
+static void ac_import_free(pTHX_ SV *handle, HV *hv, HV *cache)
+{
+    I32 count = 0, size = HvUSEDKEYS(hv);
+    struct ac_import_pair *pairs;
+    struct ac_key **keys;
+    SV **vals;
+    HE *he;
+    I32 i;
+
+    Newx(pairs, size + 1, struct ac_import_pair);
+    SAVEFREEPV(pairs);
+
+    hv_iterinit(hv);
+
+    while ((he = hv_iternext(hv)) && count < size)
+    {
+        pairs[count].key = ac_import_key(aTHX_ cache, hv_iterkeysv(he));
+        pairs[count].val = HeVAL(he);
+        count++;
+    }
+
+    qsort(pairs, count, sizeof(struct ac_import_pair), ac_import_cmp);
+
+    Newx(keys, count + 1, struct ac_key *);
+    SAVEFREEPV(keys);
+    Newx(vals, count + 1, SV *);
+    SAVEFREEPV(vals);
+
+    for (i = 0; i < count; i++)
+    {
+        keys[i] = pairs[i].key;
+        vals[i] = pairs[i].val;
+    }
+
+    ac_node_put_many(aTHX_ handle, keys, vals, count);
+}
+
+SV *ac_node_import(pTHX_ AV *recs, struct ac_template *tpl)
+{
+    AV *ret = (AV *) sv_2mortal((SV *) newAV());
+    HV *cache = (HV *) sv_2mortal((SV *) newHV());
+    SSize_t i, n = av_len(recs) + 1;
+    U32 *hashes = NULL;
+
+    if (tpl)
+    {
+        Newx(hashes, tpl->nkeys + 1, U32);
+        SAVEFREEPV(hashes);
+
+        for (i = 0; i < tpl->nkeys; i++)
+        {
+            STRLEN len;
+            const char *pv = SvPV(tpl->keys[i]->name, len);
+
+            PERL_HASH(hashes[i], pv, len);
+        }
+    }
+
+    if (n)
+        av_extend(ret, n - 1);
+
+    for (i = 0; i < n; i++)
+    {
+        SV **svp = av_fetch(recs, i, 0);
+        ac_object o;
+        SV *handle;
+
+        if (!svp || !SvROK(*svp) || SvTYPE(SvRV(*svp)) != SVt_PVHV)
+            croak("Record %ld is not a hash reference", (long) i);
+
+        o = ac_new_object(tpl ? tpl->cl : ac_shape_root(aTHX)->cl);
+        handle = ac_rehandle(aTHX_ &ac_hs_node, INT2PTR(void *, o));
+        av_store(ret, i, newRV_noinc(handle));
+
+        if (tpl)
+            ac_import_fixed(aTHX_ handle, (HV *) SvRV(*svp), tpl, hashes,
+                    cache);
+        else
+            ac_import_free(aTHX_ handle, (HV *) SvRV(*svp), cache);
+    }
+
+    return newRV_inc((SV *) ret);
+}
+
+/*
+ * Inflation to hashes.  Each shape lazily keeps its key names as shared
+ * hash key scalars, so storing them into a hash reuses the string table
+ * entry and the precomputed hash instead of hashing and copying per node.
+ */
+static SV **ac_shape_names(pTHX_ struct ac_shape *sh)
+{
+    int i;
+
+    if (sh->names)
+        return sh->names;
+
+    Newx(sh->names, sh->nkeys + 1, SV *);
+
+    for (i = 0; i < sh->nkeys; i++)
+    {
+        STRLEN len;
+        const char *pv = SvPV(sh->keys[i]->name, len);
+
+        sh->names[i] = newSVpvn_share(pv,
+                SvUTF8(sh->keys[i]->name) ? -(I32) len : (I32) len, 0);
+    }
+
+    return sh->names;
+}
+
+SV *ac_node_inflate(pTHX_ ac_object o)
+{
+    struct ac_shape *sh = ac_class_of(o)->shape;
+    SV **names = ac_shape_names(aTHX_ sh);
+    HV *hv = newHV();
+    SV **svp;
+    int i;
+
+    if (sh->nkeys)
+        hv_ksplit(hv, sh->nkeys);
+
+    for (i = 0; i < sh->nkeys; i++)
+    {
+        SV *val;
+
+        if (!AC_NODE_PRESENT(o, sh->pbits[i]))
+            continue;
+
+        val = newSV(0);
+        ac_do_get(sh->keys[i]->type, o, sh->offsets[i], val);
+        hv_store_ent(hv, names[i], val, 0);
+    }
+
+    for (i = 0; i < sh->nsparse; i++)
+        if ((svp = ac_side_find(&sh->sparse[i], o)))
+            hv_store_ent(hv, sh->sparse[i].key->name, newSVsv(*svp), 0);
+
+    return newRV_noinc((SV *) hv);
+}
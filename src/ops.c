@@ -0,0 +1,314 @@
+#include <EXTERN.h>
+#include <perl.h>
+
+#include "handle.h"
+#include "Compact.h"
+
+/*
+ * Compile-time specialization of get, put and exists.  A call checker on
+ * each looks at the key argument; if it is a constant key handle (from
+ * "use constant", or a key('name') call, which the checker on key folds
+ * into a constant), the entersub is replaced by a custom op which has the
+ * key's handle in its pad slot and only evaluates the node (and value).
+ * That drops the sub call and the argument checks.  The key is still found
+ * through the handle's magic, which Perl code cannot write to (the handle's
+ * own value it can); that is a single compare in the usual case.
+ *
+ * Only calls whose arguments are plain scalar expressions are rewritten,
+ * since the custom ops evaluate them in scalar context where the sub call
+ * would have used list context.  Everything else, including &get(...) and
+ * method calls, goes through the XSUB as before.
+ */
+
+#define AC_OP_KEY(op) \
+    ((struct ac_key *) ac_unhandle(aTHX_ &ac_hs_key, \
+        PAD_SVl((op)->op_targ), NULL, "key handle has incorrect magic"))
+
+static OP *ac_pp_get(pTHX)
+{
+    dSP;
+    SV *ret = sv_newmortal();
+
+    ac_node_get(aTHX_ ac_node_unhandle(aTHX_ TOPs, NULL), AC_OP_KEY(PL_op),
+            ret);
+    SETs(ret);
+    RETURN;
+}
+
+static OP *ac_pp_exists(pTHX)
+{
+    dSP;
+    ac_object o = ac_node_unhandle(aTHX_ TOPs, NULL);
+
+    SETs(sv_2mortal(newSViv(ac_node_exists(aTHX_ o, AC_OP_KEY(PL_op)))));
+    RETURN;
+}
+
+static OP *ac_pp_put(pTHX)
+{
+    dSP;
+    SV *val = POPs;
+    SV *handle;
+
+    ac_node_unhandle(aTHX_ POPs, &handle);
+    ac_node_put(aTHX_ handle, AC_OP_KEY(PL_op), val);
+
+    /* put returns nothing, which is undef to a scalar caller */
+    if (GIMME_V == G_SCALAR)
+        XPUSHs(&PL_sv_undef);
+
+    RETURN;
+}
+
+static XOP ac_xop_get, ac_xop_exists, ac_xop_put;
+
+/* Ops known to leave exactly one value whatever the context */
+static int ac_op_is_scalar(OP *o)
+{
+    switch (o->op_type)
+    {
+        case OP_CONST:
+        case OP_PADSV:
+        case OP_RV2SV:
+        case OP_AELEM:
+        case OP_HELEM:
+        case OP_AELEMFAST:
+        case OP_AELEMFAST_LEX:
+            return 1;
+    }
+
+    return (PL_opargs[o->op_type] & OA_RETSCALAR) != 0;
+}
+
+/* The key handle in a constant op, or NULL */
+static SV *ac_op_key_handle(pTHX_ OP *o)
+{
+    SV *sv;
+
+    if (o->op_type != OP_CONST)
+        return NULL;
+
+    sv = cSVOPx_sv(o);
+
+    if (!SvROK(sv) || !ac_unhandle(aTHX_ &ac_hs_key, SvRV(sv), NULL, NULL))
+        return NULL;
+
+    return SvRV(sv);
+}
+
+/*
+ * Detach the arguments of an entersub op, if there are exactly count of
+ * them; returns the first, with the rest as its siblings.
+ */
+static OP *ac_op_take_args(pTHX_ OP *entersubop, int count)
+{
+    OP *parent = entersubop;
+    OP *pushop = cUNOPx(entersubop)->op_first;
+    OP *o;
+    int n = 0;
+
+    if (!OpHAS_SIBLING(pushop))
+    {
+        parent = pushop;
+        pushop = cUNOPx(pushop)->op_first;
+    }
+
+    /* the last sibling is the op giving the CV */
+    for (o = OpSIBLING(pushop); o && OpHAS_SIBLING(o); o = OpSIBLING(o))
+        n++;
+
+    if (n != count)
+        return NULL;
+
+    return op_sibling_splice(parent, pushop, count, NULL);
+}
+
+/* Peek at argument i without detaching anything */
+static OP *ac_op_arg(OP *entersubop, int i)
+{
+    OP *o = cUNOPx(entersubop)->op_first;
+
+    if (!OpHAS_SIBLING(o))
+        o = cUNOPx(o)->op_first;
+
+    for (o = OpSIBLING(o); o && i; i--)
+        o = OpSIBLING(o);
+
+    return o && OpHAS_SIBLING(o) ? o : NULL;
+}
+
+static PADOFFSET ac_op_pad_key(pTHX_ SV *handle)
+{
+    PADOFFSET ix = pad_alloc(OP_CONST, SVf_READONLY);
+
+    SvREFCNT_dec(PAD_SVl(ix));
+    PAD_SETSV(ix, SvREFCNT_inc(handle));
+
+    return ix;
+}
+
+static OP *ac_ck_node_op(pTHX_ OP *entersubop, GV *namegv, SV *ckobj,
+        int nargs, Perl_ppaddr_t pp)
+{
+    OP *nodeop = ac_op_arg(entersubop, 0);
+    OP *keyop = ac_op_arg(entersubop, 1);
+    OP *valop = nargs > 2 ? ac_op_arg(entersubop, 2) : NULL;
+    SV *handle;
+    OP *newop;
+
+    if (!nodeop || !keyop || (nargs > 2 && !valop) ||
+            ac_op_arg(entersubop, nargs) || !ac_op_is_scalar(nodeop) ||
+            (valop && !ac_op_is_scalar(valop)) ||
+            !(handle = ac_op_key_handle(aTHX_ keyop)))
+        return ck_entersub_args_proto_or_list(entersubop, namegv, ckobj);
+
+    nodeop = ac_op_take_args(aTHX_ entersubop, nargs);
+    keyop = OpSIBLING(nodeop);
+    valop = nargs > 2 ? OpSIBLING(keyop) : NULL;
+    OpLASTSIB_set(nodeop, NULL);
+    OpLASTSIB_set(keyop, NULL);
+    SvREFCNT_inc(handle);
+    op_free(keyop);
+    op_free(entersubop);
+
+    nodeop = op_contextualize(nodeop, G_SCALAR);
+
+    if (valop)
+        newop = newBINOP(OP_CUSTOM, 0, nodeop,
+                op_contextualize(valop, G_SCALAR));
+    else
+        newop = newUNOP(OP_CUSTOM, 0, nodeop);
+
+    newop->op_ppaddr = pp;
+    newop->op_targ = ac_op_pad_key(aTHX_ handle);
+    SvREFCNT_dec(handle);
+
+    return newop;
+}
+
+static OP *ac_ck_get(pTHX_ OP *entersubop, GV *namegv, SV *ckobj)
+{
+    return ac_ck_node_op(aTHX_ entersubop, namegv, ckobj, 2, ac_pp_get);
+}
+
+static OP *ac_ck_exists(pTHX_ OP *entersubop, GV *namegv, SV *ckobj)
+{
+    return ac_ck_node_op(aTHX_ entersubop, namegv, ckobj, 2, ac_pp_exists);
+}
+
+static OP *ac_ck_put(pTHX_ OP *entersubop, GV *namegv, SV *ckobj)
+{
+    return ac_ck_node_op(aTHX_ entersubop, namegv, ckobj, 3, ac_pp_put);
+}
+
+/*
+ * key('name') always returns the same key, so a call with a constant name
+ * is made at compile time and replaced by the result.
+ */
+static OP *ac_ck_key(pTHX_ OP *entersubop, GV *namegv, SV *ckobj)
+{
+    OP *nameop = ac_op_arg(entersubop, 0);
+    SV *key;
+
+    if (!nameop || ac_op_arg(entersubop, 1) || nameop->op_type != OP_CONST ||
+            !SvPOK(cSVOPx_sv(nameop)) || SvROK(cSVOPx_sv(nameop)))
+        return ck_entersub_args_proto_or_list(entersubop, namegv, ckobj);
+
+    key = ac_key(aTHX_ cSVOPx_sv(nameop), NULL);
+
+    op_free(entersubop);
+    return newSVOP(OP_CONST, 0, key);
+}
+
+/*
+ * Lazy blessing.  While ac_param_lazy_bless is set, new node handles are
+ * left unblessed, and these wrappers round ref and method lookup bless a
+ * node handle the first time one of them sees it; anything else goes
+ * straight through.  They are installed in PL_ppaddr the first time the
+ * mode is turned on, so only code compiled after that reaches them, and
+ * nothing pays for them in a program which never uses the mode.  Handles
+ * made while the mode was on may still be about after it is turned off,
+ * so once installed the wrappers stay, and always look, but only go on to
+ * the magic for an unblessed reference to a PVMG.
+ */
+static Perl_ppaddr_t ac_next_pp[MAXO];
+
+static const int ac_method_ops[] = {
+    OP_METHOD, OP_METHOD_NAMED,
+#if PERL_VERSION >= 22
+    OP_METHOD_SUPER, OP_METHOD_REDIR, OP_METHOD_REDIR_SUPER,
+#endif
+};
+
+#define AC_MAYBE_LAZY(sv) \
+    (SvROK(sv) && !SvOBJECT(SvRV(sv)) && SvTYPE(SvRV(sv)) == SVt_PVMG)
+
+static OP *ac_pp_ref(pTHX)
+{
+    if (AC_MAYBE_LAZY(*PL_stack_sp))
+        ac_node_bless(aTHX_ *PL_stack_sp);
+
+    return ac_next_pp[OP_REF](aTHX);
+}
+
+/* The invocant of a method call is the first argument after the mark */
+static OP *ac_pp_method(pTHX)
+{
+    SV **invp = PL_stack_base + TOPMARK + 1;
+
+    if (invp <= PL_stack_sp && AC_MAYBE_LAZY(*invp))
+        ac_node_bless(aTHX_ *invp);
+
+    return ac_next_pp[PL_op->op_type](aTHX);
+}
+
+void ac_install_lazy_ops(pTHX)
+{
+    UV i;
+
+    if (PL_ppaddr[OP_REF] == ac_pp_ref)
+        return;
+
+    ac_next_pp[OP_REF] = PL_ppaddr[OP_REF];
+    PL_ppaddr[OP_REF] = ac_pp_ref;
+
+    for (i = 0; i < sizeof(ac_method_ops) / sizeof(ac_method_ops[0]); i++)
+    {
+        ac_next_pp[ac_method_ops[i]] = PL_ppaddr[ac_method_ops[i]];
+        PL_ppaddr[ac_method_ops[i]] = ac_pp_method;
+    }
+}
+
+static void ac_op_register(pTHX_ XOP *xop, Perl_ppaddr_t pp, const char *name,
+        const char *desc, U32 cls)
+{
+    XopENTRY_set(xop, xop_name, name);
+    XopENTRY_set(xop, xop_desc, desc);
+    XopENTRY_set(xop, xop_class, cls);
+    Perl_custom_op_register(aTHX_ pp, xop);
+}
+
+static void ac_op_check(pTHX_ const char *name, Perl_call_checker ck)
+{
+    CV *cv = get_cv(name, 0);
+
+    if (!cv)
+        croak("internal error: %s is not defined", name);
+
+    cv_set_call_checker(cv, ck, (SV *) cv);
+}
+
+void ac_install_ops(pTHX)
+{
+    ac_op_register(aTHX_ &ac_xop_get, ac_pp_get, "ac_get",
+            "Arena::Compact get", OA_UNOP);
+    ac_op_register(aTHX_ &ac_xop_exists, ac_pp_exists, "ac_exists",
+            "Arena::Compact exists", OA_UNOP);
+    ac_op_register(aTHX_ &ac_xop_put, ac_pp_put, "ac_put",
+            "Arena::Compact put", OA_BINOP);
+
+    ac_op_check(aTHX_ "Arena::Compact::get", ac_ck_get);
+    ac_op_check(aTHX_ "Arena::Compact::exists", ac_ck_exists);
+    ac_op_check(aTHX_ "Arena::Compact::put", ac_ck_put);
+    ac_op_check(aTHX_ "Arena::Compact::key", ac_ck_key);
+}
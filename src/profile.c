@@ -0,0 +1,233 @@
+#include <EXTERN.h>
+#include <perl.h>
+
+#include "handle.h"
+#include "Compact.h"
+
+/*
+ * Access profiling.  The point is to make layout decisions (hot/cold
+ * splitting, field order) from what a real workload does rather than from
+ * guesses; so this is cheap when off (one test in ac_do_get/ac_do_set) and
+ * merely not awful when on.
+ *
+ * Counts are kept per class, indexed by the field number in the class's
+ * record type; classes that have been counted are chained together so that
+ * they can be dumped.  Classes whose type is not a record get one bucket.
+ */
+
+int ac_param_profile = 0;
+int ac_param_profile_cold_ratio = 16;
+
+static struct ac_class *profiled;
+
+static int ac_profile_buckets(struct ac_class *cl)
+{
+    int nf = ac_record_nfields(cl->dtype);
+
+    return nf > 0 ? nf : 1;
+}
+
+void ac_profile_count(ac_object o, UV off, int is_set)
+{
+    struct ac_class *cl = ac_class_of(o);
+    int ix = 0;
+
+    if (!cl->profile_counts)
+    {
+        Newxz(cl->profile_counts, 2 * ac_profile_buckets(cl), UV);
+        cl->profile_next = profiled;
+        profiled = cl;
+    }
+
+    if (ac_record_nfields(cl->dtype) > 0)
+        ix = ac_record_field_at(cl->dtype, off);
+
+    if (ix >= 0)
+        cl->profile_counts[2 * ix + is_set]++;
+}
+
+void ac_profile_reset(void)
+{
+    struct ac_class *cl;
+
+    for (cl = profiled; cl; cl = cl->profile_next)
+        Zero(cl->profile_counts, 2 * ac_profile_buckets(cl), UV);
+}
+
+/* Called when a class is deleted */
+void ac_profile_forget(struct ac_class *cl)
+{
+    struct ac_class **clp;
+
+    if (!cl->profile_counts)
+        return;
+
+    for (clp = &profiled; *clp; clp = &(*clp)->profile_next)
+    {
+        if (*clp == cl)
+        {
+            *clp = cl->profile_next;
+            break;
+        }
+    }
+
+    Safefree(cl->profile_counts);
+    cl->profile_counts = NULL;
+}
+
+int ac_profile_hints(struct ac_class *cl, struct ac_field_spec **specp)
+{
+    int nf = ac_record_nfields(cl->dtype);
+    UV hottest = 0;
+    int i;
+
+    if (nf < 0)
+        croak("Layout hints are only available for record classes");
+
+    Newxz(*specp, nf ? nf : 1, struct ac_field_spec);
+
+    for (i = 0; i < nf; i++)
+    {
+        struct ac_field_spec *sp = &(*specp)[i];
+
+        ac_record_field_spec(cl->dtype, i, sp);
+        sp->flags &= ~AC_FIELD_COLD;
+
+        if (cl->profile_counts)
+            sp->weight = cl->profile_counts[2 * i] +
+                cl->profile_counts[2 * i + 1];
+
+        if (sp->weight > hottest)
+            hottest = sp->weight;
+    }
+
+    /* Without any counts, there is nothing to go on; leave everything hot */
+    for (i = 0; hottest && i < nf; i++)
+    {
+        struct ac_field_spec *sp = &(*specp)[i];
+
+        if (sp->weight < hottest / ac_param_profile_cold_ratio)
+            sp->flags |= AC_FIELD_COLD;
+    }
+
+    return nf;
+}
+
+/*
+ * [ { class => $handle, type => "record { ... }",
+ *     fields => { name => { get => N, set => N, weight => N, cold => B } } },
+ *   ... ]
+ */
+SV *ac_profile_dump(pTHX)
+{
+    AV *ret = newAV();
+    struct ac_class *cl;
+
+    for (cl = profiled; cl; cl = cl->profile_next)
+    {
+        HV *entry = newHV();
+        HV *fields = newHV();
+        SV *deparse = newSVpvs("");
+        struct ac_field_spec *spec = NULL;
+        int nf = ac_record_nfields(cl->dtype);
+        int i;
+
+        if (cl->dtype->ops->deparse)
+            cl->dtype->ops->deparse(cl->dtype, deparse);
+
+        if (nf >= 0)
+            ac_profile_hints(cl, &spec);
+
+        for (i = 0; i < (nf >= 0 ? nf : 1); i++)
+        {
+            HV *counts = newHV();
+            const char *name = spec ? spec[i].name : "";
+            STRLEN namelen = spec ? spec[i].namelen : 0;
+
+            (void)hv_stores(counts, "get",
+                    newSVuv(cl->profile_counts[2 * i]));
+            (void)hv_stores(counts, "set",
+                    newSVuv(cl->profile_counts[2 * i + 1]));
+
+            if (spec)
+            {
+                (void)hv_stores(counts, "weight", newSVuv(spec[i].weight));
+                (void)hv_stores(counts, "cold",
+                        newSViv((spec[i].flags & AC_FIELD_COLD) ? 1 : 0));
+            }
+
+            (void)hv_store(fields, name, namelen,
+                    newRV_noinc((SV *)counts), 0);
+        }
+
+        Safefree(spec);
+
+        (void)hv_stores(entry, "class", newRV_inc(cl->reflection));
+        (void)hv_stores(entry, "type", deparse);
+        (void)hv_stores(entry, "fields", newRV_noinc((SV *)fields));
+
+        av_push(ret, newRV_noinc((SV *)entry));
+    }
+
+    return newRV_noinc((SV *)ret);
+}
+
+/* [ { name => $name, type => $type, cold => B, weight => N }, ... ] */
+SV *ac_profile_hints_dump(pTHX_ struct ac_class *cl)
+{
+    AV *ret = newAV();
+    struct ac_field_spec *spec;
+    int nf = ac_profile_hints(cl, &spec);
+    int i;
+
+    for (i = 0; i < nf; i++)
+    {
+        HV *field = newHV();
+        SV *type = newSVpvs("");
+
+        if (spec[i].type->ops->deparse)
+            spec[i].type->ops->deparse(spec[i].type, type);
+
+        (void)hv_stores(field, "name",
+                newSVpvn(spec[i].name, spec[i].namelen));
+        (void)hv_stores(field, "type", type);
+        (void)hv_stores(field, "cold",
+                newSViv((spec[i].flags & AC_FIELD_COLD) ? 1 : 0));
+        (void)hv_stores(field, "weight", newSVuv(spec[i].weight));
+
+        av_push(ret, newRV_noinc((SV *)field));
+    }
+
+    Safefree(spec);
+
+    return newRV_noinc((SV *)ret);
+}
+
+/* { name => { offset => N, cold => B } }, offsets in bits into the segment */
+SV *ac_layout_dump(pTHX_ struct ac_class *cl)
+{
+    HV *ret = newHV();
+    int nf = ac_record_nfields(cl->dtype);
+    int i;
+
+    if (nf < 0)
+        croak("Layouts are only available for record classes");
+
+    for (i = 0; i < nf; i++)
+    {
+        HV *where = newHV();
+        struct ac_field_spec sp;
+        SV *name;
+        UV off, pbit;
+
+        ac_record_field_spec(cl->dtype, i, &sp);
+        name = sv_2mortal(newSVpvn(sp.name, sp.namelen));
+        ac_record_locate(cl->dtype, name, &off, &pbit);
+
+        (void)hv_stores(where, "offset", newSVuv(off & ~AC_COLD_BIT));
+        (void)hv_stores(where, "cold", newSViv(AC_IS_COLD(off) ? 1 : 0));
+        (void)hv_store_ent(ret, name, newRV_noinc((SV *)where), 0);
+    }
+
+    return newRV_noinc((SV *)ret);
+}
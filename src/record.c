@@ -0,0 +1,532 @@
+#include <EXTERN.h>
+#include <perl.h>
+
+#include "handle.h"
+#include "Compact.h"
+
+/*
+ * Record types - a fixed set of named fields, each of some type, laid out
+ * one after another.  Fields can be marked cold, in which case they go into
+ * the cold segment of the class (see storage.c) instead of the main object
+ * storage.  This keeps the fields that every traversal touches packed
+ * densely, while metadata that is seldom read doesn't cost cache lines.
+ *
+ * Field offsets for cold fields carry AC_COLD_BIT; since the cold segment is
+ * per-class, a record with cold fields cannot be nested inside another type.
+ *
+ * Fields are kept in declaration order for lookup and deparsing, but their
+ * offsets are assigned by ac_record_layout, which is free to reorder them;
+ * nothing outside this file can tell, since subobjects resolve by name.
+ *
+ * Optional fields each get a bit in a presence bitmap, which is always hot.
+ * An absent field is zeroed and behaves as if it did not exist; making it
+ * present again only initializes it and sets the bit, so an object can
+ * gain and lose optional fields without changing class.
+ */
+
+struct ac_record_field
+{
+    char *name;
+    STRLEN namelen;
+    struct ac_type *type;
+    UV offset;
+    UV pbit;
+    unsigned int flags;
+};
+
+struct ac_record_type
+{
+    struct ac_type base;
+    int nfields;
+    struct ac_record_field *fields;
+    int noptional;
+};
+
+static int ac_record_present(struct ac_record_field *f, ac_object obj,
+        UV bit_in_obj)
+{
+    return f->pbit == AC_ALWAYS_PRESENT ||
+        ac_object_fetch(obj, bit_in_obj + f->pbit, 1);
+}
+
+static void ac_record_clear(struct ac_record_field *f, ac_object obj,
+        UV bit_in_obj)
+{
+    UV chunk = sizeof(UV) * CHAR_BIT;
+    UV size = f->type->inline_size;
+    UV bit;
+
+    for (bit = 0; bit < size; bit += chunk)
+        ac_object_store(obj, bit_in_obj + f->offset + bit,
+                size - bit < chunk ? size - bit : chunk, 0);
+}
+
+static struct ac_record_field *ac_record_find(struct ac_record_type *rt,
+        SV *name)
+{
+    dTHX;
+    STRLEN len;
+    const char *pv = SvPV(name, len);
+    int i;
+
+    for (i = 0; i < rt->nfields; i++)
+    {
+        struct ac_record_field *f = &rt->fields[i];
+
+        if (f->namelen == len && memEQ(f->name, pv, len))
+            return f;
+    }
+
+    return NULL;
+}
+
+static void ac_record_subobject(struct ac_type *ty, ac_object obj,
+        UV bit_in_obj, SV *name, ac_object *oret, UV *bret,
+        struct ac_type **tyret)
+{
+    dTHX;
+    struct ac_record_field *f = ac_record_find((struct ac_record_type *)ty,
+            name);
+
+    if (!f || !ac_record_present(f, obj, bit_in_obj))
+        croak("Field \"%" SVf "\" not found", SVfARG(name));
+
+    *oret = obj;
+    *bret = bit_in_obj + f->offset;
+    *tyret = f->type;
+}
+
+static int ac_record_subobject_exists(struct ac_type *ty, ac_object obj,
+        UV bit_in_obj, SV *name)
+{
+    struct ac_record_field *f = ac_record_find((struct ac_record_type *)ty,
+            name);
+
+    return f && ac_record_present(f, obj, bit_in_obj);
+}
+
+static struct ac_record_field *ac_record_find_optional(struct ac_type *ty,
+        SV *name)
+{
+    dTHX;
+    struct ac_record_field *f = ac_record_find((struct ac_record_type *)ty,
+            name);
+
+    if (!f)
+        croak("Field \"%" SVf "\" not found", SVfARG(name));
+    if (f->pbit == AC_ALWAYS_PRESENT)
+        croak("Field \"%" SVf "\" is not optional", SVfARG(name));
+
+    return f;
+}
+
+static void ac_record_subobject_add(struct ac_type *ty, ac_object obj,
+        UV bit_in_obj, SV *name)
+{
+    dTHX;
+    struct ac_record_field *f = ac_record_find_optional(ty, name);
+
+    if (ac_record_present(f, obj, bit_in_obj))
+        croak("Field \"%" SVf "\" is already present", SVfARG(name));
+
+    if (f->type->flags & AC_INITIALIZE_USED)
+        f->type->ops->initialize(f->type, obj, bit_in_obj + f->offset);
+
+    ac_object_store(obj, bit_in_obj + f->pbit, 1, 1);
+}
+
+static void ac_record_subobject_delete(struct ac_type *ty, ac_object obj,
+        UV bit_in_obj, SV *name)
+{
+    dTHX;
+    struct ac_record_field *f = ac_record_find_optional(ty, name);
+
+    if (!ac_record_present(f, obj, bit_in_obj))
+        croak("Field \"%" SVf "\" not found", SVfARG(name));
+
+    if (f->type->flags & AC_DESTROY_USED)
+        f->type->ops->destroy(f->type, obj, bit_in_obj + f->offset);
+
+    ac_record_clear(f, obj, bit_in_obj);
+    ac_object_store(obj, bit_in_obj + f->pbit, 1, 0);
+}
+
+static void ac_record_initialize(struct ac_type *ty, ac_object obj,
+        UV bit_in_obj)
+{
+    struct ac_record_type *rt = (struct ac_record_type *) ty;
+    int i;
+
+    for (i = 0; i < rt->nfields; i++)
+    {
+        struct ac_type *fty = rt->fields[i].type;
+
+        /* Optional fields start absent */
+        if (rt->fields[i].pbit != AC_ALWAYS_PRESENT)
+            continue;
+
+        if (fty->flags & AC_INITIALIZE_USED)
+            fty->ops->initialize(fty, obj, bit_in_obj + rt->fields[i].offset);
+    }
+}
+
+static void ac_record_destroy(struct ac_type *ty, ac_object obj,
+        UV bit_in_obj)
+{
+    struct ac_record_type *rt = (struct ac_record_type *) ty;
+    int i;
+
+    for (i = 0; i < rt->nfields; i++)
+    {
+        struct ac_type *fty = rt->fields[i].type;
+
+        if ((fty->flags & AC_DESTROY_USED) &&
+                ac_record_present(&rt->fields[i], obj, bit_in_obj))
+            fty->ops->destroy(fty, obj, bit_in_obj + rt->fields[i].offset);
+    }
+}
+
+static void ac_record_translocate(struct ac_type *ty, ac_object oldo,
+        ac_object newo, UV bit_in_obj)
+{
+    struct ac_record_type *rt = (struct ac_record_type *) ty;
+    int i;
+
+    for (i = 0; i < rt->nfields; i++)
+    {
+        struct ac_type *fty = rt->fields[i].type;
+
+        if ((fty->flags & AC_TRANSLOCATE_USED) &&
+                ac_record_present(&rt->fields[i], oldo, bit_in_obj))
+            fty->ops->translocate(fty, oldo, newo,
+                    bit_in_obj + rt->fields[i].offset);
+    }
+}
+
+static void ac_record_mark(struct ac_type *ty, ac_object obj, UV bit_in_obj)
+{
+    struct ac_record_type *rt = (struct ac_record_type *) ty;
+    int i;
+
+    for (i = 0; i < rt->nfields; i++)
+    {
+        struct ac_type *fty = rt->fields[i].type;
+
+        if ((fty->flags & AC_MARK_USED) &&
+                ac_record_present(&rt->fields[i], obj, bit_in_obj))
+            fty->ops->mark(fty, obj, bit_in_obj + rt->fields[i].offset);
+    }
+}
+
+static void ac_record_forwardize(struct ac_type *ty, ac_object obj,
+        UV bit_in_obj)
+{
+    struct ac_record_type *rt = (struct ac_record_type *) ty;
+    int i;
+
+    for (i = 0; i < rt->nfields; i++)
+    {
+        struct ac_type *fty = rt->fields[i].type;
+
+        if ((fty->flags & AC_FORWARDIZE_USED) &&
+                ac_record_present(&rt->fields[i], obj, bit_in_obj))
+            fty->ops->forwardize(fty, obj, bit_in_obj + rt->fields[i].offset);
+    }
+}
+
+static void ac_record_deparse(struct ac_type *ty, SV *strbuf)
+{
+    dTHX;
+    struct ac_record_type *rt = (struct ac_record_type *) ty;
+    int i;
+
+    sv_catpvs(strbuf, "record {");
+
+    for (i = 0; i < rt->nfields; i++)
+    {
+        struct ac_record_field *f = &rt->fields[i];
+
+        sv_catpv(strbuf, i ? ", " : " ");
+        if (AC_IS_COLD(f->offset))
+            sv_catpvs(strbuf, "cold ");
+        if (f->pbit != AC_ALWAYS_PRESENT)
+            sv_catpvs(strbuf, "optional ");
+        sv_catpvn(strbuf, f->name, f->namelen);
+        sv_catpvs(strbuf, " => ");
+        if (f->type->ops->deparse)
+            f->type->ops->deparse(f->type, strbuf);
+        else
+            sv_catpvs(strbuf, "?");
+    }
+
+    sv_catpvs(strbuf, " }");
+}
+
+static void ac_record_free_type(struct ac_type *ty)
+{
+    dTHX;
+    struct ac_record_type *rt = (struct ac_record_type *) ty;
+    int i;
+
+    for (i = 0; i < rt->nfields; i++)
+    {
+        SvREFCNT_dec(rt->fields[i].type->reflection);
+        Safefree(rt->fields[i].name);
+    }
+
+    Safefree(rt->fields);
+    Safefree(rt);
+}
+
+/*
+ * Layout.  Objects are bit strings, so any order is *possible*, but a field
+ * which straddles a byte or word boundary costs extra work on every access.
+ * We sort fields into alignment classes:
+ *
+ *   0. multiples of the word size (and empty fields), which keep everything
+ *      after them aligned and so go first, in any order;
+ *   1. power-of-two sizes below a word, by decreasing size - each of these
+ *      then lands on a multiple of its own size;
+ *   2. other sizes below a word, by decreasing size;
+ *   3. other sizes above a word, last, where misalignment only hurts them.
+ *
+ * Within a class (and size, for 1 and 2) higher weights go first, so that
+ * frequently accessed fields cluster at the front of the object; ties keep
+ * declaration order.  No padding is ever inserted.
+ *
+ * Alignment is relative to the start of the object, and so only pays off
+ * in full when the class's object size is itself aligned.
+ *
+ * The presence bitmap is laid out with the hot fields, as a pseudo-field
+ * which sorts ahead of the others of its size.
+ */
+
+#define AC_WORD_BITS (sizeof(UV) * CHAR_BIT)
+
+struct ac_layout_slot
+{
+    int index;
+    int klass;
+    UV size;
+    UV weight;
+};
+
+static int ac_layout_cmp(const void *av, const void *bv)
+{
+    const struct ac_layout_slot *a = (const struct ac_layout_slot *) av;
+    const struct ac_layout_slot *b = (const struct ac_layout_slot *) bv;
+
+    if (a->klass != b->klass)
+        return a->klass < b->klass ? -1 : 1;
+    if ((a->klass == 1 || a->klass == 2) && a->size != b->size)
+        return a->size > b->size ? -1 : 1;
+    if (a->weight != b->weight)
+        return a->weight > b->weight ? -1 : 1;
+    return a->index < b->index ? -1 : (a->index > b->index);
+}
+
+static int ac_layout_class(UV size)
+{
+    if (size % AC_WORD_BITS == 0)
+        return 0;
+    if (size > AC_WORD_BITS)
+        return 3;
+    return (size & (size - 1)) ? 2 : 1;
+}
+
+/* Assign offsets to the fields of one segment; returns its size. */
+static UV ac_record_layout(struct ac_record_field *fields,
+        const struct ac_field_spec *spec, int nfields, unsigned int cold,
+        UV bitmap_bits, UV *bitmap_off)
+{
+    struct ac_layout_slot *slots;
+    int i, nslots = 0;
+    UV size = 0;
+
+    Newx(slots, nfields + 1, struct ac_layout_slot);
+
+    if (bitmap_bits)
+    {
+        slots[nslots].index = nfields;
+        slots[nslots].size = bitmap_bits;
+        slots[nslots].klass = ac_layout_class(bitmap_bits);
+        slots[nslots].weight = ~(UV)0;
+        nslots++;
+    }
+
+    for (i = 0; i < nfields; i++)
+    {
+        if ((spec[i].flags & AC_FIELD_COLD) != cold)
+            continue;
+
+        slots[nslots].index = i;
+        slots[nslots].size = spec[i].type->inline_size;
+        slots[nslots].klass = ac_layout_class(slots[nslots].size);
+        slots[nslots].weight = spec[i].weight;
+        nslots++;
+    }
+
+    qsort(slots, nslots, sizeof(struct ac_layout_slot), ac_layout_cmp);
+
+    for (i = 0; i < nslots; i++)
+    {
+        if (slots[i].index == nfields)
+            *bitmap_off = size;
+        else
+            fields[slots[i].index].offset = (cold ? AC_COLD_BIT : 0) | size;
+
+        AC_OVERFLOW_CHECK(size, slots[i].size);
+        size += slots[i].size;
+    }
+
+    Safefree(slots);
+
+    return size;
+}
+
+static struct ac_type_ops ac_record_ops = {
+    ac_record_subobject,
+    ac_record_subobject_exists,
+    ac_record_subobject_add,
+    ac_record_subobject_delete,
+    NULL, /* scalar_get */
+    NULL, /* scalar_put */
+    NULL, /* scalar_parse */
+    NULL, /* scalar_normalize */
+    ac_record_initialize,
+    ac_record_destroy,
+    ac_record_translocate,
+    NULL, /* postcompact */
+    ac_record_mark,
+    ac_record_forwardize,
+    ac_record_deparse,
+    ac_record_free_type
+};
+
+struct ac_type *ac_make_record_type_spec(int nfields,
+        const struct ac_field_spec *spec)
+{
+    dTHX;
+    struct ac_record_type *rt;
+    unsigned int flags = 0;
+    UV hot_size, cold_size, bitmap_off = 0;
+    int i, opt;
+
+    for (i = 0; i < nfields; i++)
+        if (spec[i].type->cold_size)
+            croak("A record with cold fields cannot be used as a field type");
+
+    Newxz(rt, 1, struct ac_record_type);
+    Newxz(rt->fields, nfields ? nfields : 1, struct ac_record_field);
+    rt->nfields = nfields;
+
+    for (i = 0; i < nfields; i++)
+    {
+        struct ac_record_field *f = &rt->fields[i];
+        struct ac_type *fty = spec[i].type;
+
+        f->namelen = spec[i].namelen ? spec[i].namelen :
+            strlen(spec[i].name);
+        f->name = savepvn(spec[i].name, f->namelen);
+        f->type = fty;
+        f->flags = spec[i].flags;
+        f->pbit = AC_ALWAYS_PRESENT;
+        SvREFCNT_inc(fty->reflection);
+
+        if (f->flags & AC_FIELD_OPTIONAL)
+            rt->noptional++;
+
+        flags |= fty->flags & (AC_INITIALIZE_USED | AC_DESTROY_USED |
+                AC_TRANSLOCATE_USED | AC_MARK_USED | AC_FORWARDIZE_USED);
+    }
+
+    hot_size = ac_record_layout(rt->fields, spec, nfields, 0,
+            rt->noptional, &bitmap_off);
+    cold_size = ac_record_layout(rt->fields, spec, nfields, AC_FIELD_COLD,
+            0, NULL);
+
+    for (i = 0, opt = 0; i < nfields; i++)
+        if (rt->fields[i].flags & AC_FIELD_OPTIONAL)
+            rt->fields[i].pbit = bitmap_off + opt++;
+
+    ac_init_type(&rt->base, &ac_record_ops, hot_size, flags);
+    rt->base.cold_size = cold_size;
+
+    return &rt->base;
+}
+
+struct ac_type *ac_make_record_type(int nfields, const char **names,
+        struct ac_type **types)
+{
+    struct ac_field_spec *spec;
+    struct ac_type *ty;
+    int i;
+
+    Newxz(spec, nfields ? nfields : 1, struct ac_field_spec);
+
+    for (i = 0; i < nfields; i++)
+    {
+        spec[i].name = names[i];
+        spec[i].type = types[i];
+    }
+
+    ty = ac_make_record_type_spec(nfields, spec);
+    Safefree(spec);
+
+    return ty;
+}
+
+/*
+ * Introspection, for the profiler and layout tools.  Fields are numbered in
+ * declaration order.
+ */
+
+int ac_record_nfields(struct ac_type *ty)
+{
+    return ty->ops == &ac_record_ops ?
+        ((struct ac_record_type *)ty)->nfields : -1;
+}
+
+/* Which field contains the given offset?  -1 if none does. */
+int ac_record_field_at(struct ac_type *ty, UV off)
+{
+    struct ac_record_type *rt = (struct ac_record_type *) ty;
+    int i;
+
+    for (i = 0; i < rt->nfields; i++)
+    {
+        struct ac_record_field *f = &rt->fields[i];
+
+        if (AC_IS_COLD(f->offset) == AC_IS_COLD(off) &&
+                off >= f->offset && off - f->offset < f->type->inline_size)
+            return i;
+    }
+
+    return -1;
+}
+
+void ac_record_field_spec(struct ac_type *ty, int ix, struct ac_field_spec *sp)
+{
+    struct ac_record_field *f = &((struct ac_record_type *)ty)->fields[ix];
+
+    sp->name = f->name;
+    sp->namelen = f->namelen;
+    sp->type = f->type;
+    sp->flags = f->flags;
+    sp->weight = 0;
+}
+
+/* Like subobject, but without an object, so presence is not checked */
+struct ac_type *ac_record_locate(struct ac_type *ty, SV *name, UV *offp,
+        UV *pbitp)
+{
+    struct ac_record_field *f = ac_record_find((struct ac_record_type *)ty,
+            name);
+
+    if (!f)
+        return NULL;
+
+    *offp = f->offset;
+    *pbitp = f->pbit;
+    return f->type;
+}
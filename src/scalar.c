@@ -0,0 +1,451 @@
+#include <EXTERN.h>
+#include <perl.h>
+
+#include "handle.h"
+#include "Compact.h"
+
+/*
+ * Scalar types.  The SV type gives up on compactness for the value itself
+ * and stores a pointer to an ordinary Perl scalar; it is the fallback for
+ * node fields, and handles anything Perl can.  Integer types store the
+ * value itself in exactly as many bits as asked for, signed or not.
+ */
+
+#define AC_PTR_BITS (sizeof(SV *) * CHAR_BIT)
+
+static SV *ac_sv_fetch(ac_object obj, UV bit_in_obj)
+{
+    return INT2PTR(SV *, ac_object_fetch(obj, bit_in_obj, AC_PTR_BITS));
+}
+
+static void ac_sv_get(struct ac_type *ty, ac_object obj, UV bit_in_obj,
+        SV *ret)
+{
+    dTHX;
+    SV *val = ac_sv_fetch(obj, bit_in_obj);
+
+    sv_setsv(ret, val ? val : &PL_sv_undef);
+}
+
+static void ac_sv_put(struct ac_type *ty, ac_object obj, UV bit_in_obj,
+        SV *from)
+{
+    dTHX;
+    SV *val = ac_sv_fetch(obj, bit_in_obj);
+
+    if (val)
+        sv_setsv(val, from);
+    else
+        ac_object_store(obj, bit_in_obj, AC_PTR_BITS, PTR2UV(newSVsv(from)));
+}
+
+static void ac_sv_parse(struct ac_type *ty, ac_object obj, UV bit_in_obj,
+        const char *pv, STRLEN len)
+{
+    dTHX;
+    SV *val = ac_sv_fetch(obj, bit_in_obj);
+
+    if (val)
+        sv_setpvn(val, pv, len);
+    else
+        ac_object_store(obj, bit_in_obj, AC_PTR_BITS,
+                PTR2UV(newSVpvn(pv, len)));
+}
+
+static void ac_sv_destroy(struct ac_type *ty, ac_object obj, UV bit_in_obj)
+{
+    dTHX;
+
+    SvREFCNT_dec(ac_sv_fetch(obj, bit_in_obj));
+    ac_object_store(obj, bit_in_obj, AC_PTR_BITS, 0);
+}
+
+static void ac_sv_deparse(struct ac_type *ty, SV *strbuf)
+{
+    dTHX;
+
+    sv_catpvs(strbuf, "sv");
+}
+
+static void ac_sv_free_type(struct ac_type *ty)
+{
+    croak("internal error: the SV type should never be freed");
+}
+
+static struct ac_type_ops ac_sv_ops = {
+    NULL, /* subobject */
+    NULL, /* subobject_exists */
+    NULL, /* subobject_add */
+    NULL, /* subobject_delete */
+    ac_sv_get,
+    ac_sv_put,
+    ac_sv_parse,
+    NULL, /* scalar_normalize */
+    NULL, /* initialize */
+    ac_sv_destroy,
+    NULL, /* translocate */
+    NULL, /* postcompact */
+    NULL, /* mark */
+    NULL, /* forwardize */
+    ac_sv_deparse,
+    ac_sv_free_type
+};
+
+/* There is only one; we keep a reference to it forever. */
+static struct ac_type *ac_sv_type;
+
+struct ac_type *ac_make_sv_type(void)
+{
+    if (!ac_sv_type)
+    {
+        Newxz(ac_sv_type, 1, struct ac_type);
+        ac_init_type(ac_sv_type, &ac_sv_ops, AC_PTR_BITS, AC_DESTROY_USED);
+    }
+
+    SvREFCNT_inc(ac_sv_type->reflection);
+    return ac_sv_type;
+}
+
+/* Integers.  Bit counts up to the width of a UV. */
+
+#define AC_UV_BITS (sizeof(UV) * CHAR_BIT)
+
+static UV ac_uint_max(struct ac_type *ty)
+{
+    return ty->inline_size == AC_UV_BITS ? UV_MAX :
+        ((UV) 1 << ty->inline_size) - 1;
+}
+
+static IV ac_int_max(struct ac_type *ty)
+{
+    return (IV) (ac_uint_max(ty) >> 1);
+}
+
+static void ac_int_range_croak(struct ac_type *ty, const char *what)
+{
+    dTHX;
+    SV *name = sv_2mortal(newSVpvs(""));
+
+    ty->ops->deparse(ty, name);
+    croak("Value %s out of range for %" SVf, what, SVfARG(name));
+}
+
+/*
+ * Parse an optionally signed decimal integer into a magnitude, which must
+ * not exceed max.  Returns nonzero for negative values.
+ */
+static int ac_int_parse_text(struct ac_type *ty, const char *pv, STRLEN len,
+        UV max, UV *magp)
+{
+    dTHX;
+    const char *p = pv, *e = pv + len;
+    int neg = 0;
+    UV mag = 0;
+
+    if (p < e && (*p == '-' || *p == '+'))
+        neg = *p++ == '-';
+
+    if (p == e)
+        croak("\"%.*s\" is not an integer", (int) len, pv);
+
+    for (; p < e; p++)
+    {
+        if (*p < '0' || *p > '9')
+            croak("\"%.*s\" is not an integer", (int) len, pv);
+
+        if (mag > (max - (*p - '0')) / 10)
+            ac_int_range_croak(ty, form("\"%.*s\"", (int) len, pv));
+
+        mag = mag * 10 + (*p - '0');
+    }
+
+    *magp = mag;
+    return neg;
+}
+
+/*
+ * The integer in an SV, as for ac_int_parse_text.  Anything which is not a
+ * number, or a string that looks like one, or which has a fractional part,
+ * croaks; so do numbers too big for a UV either way.
+ */
+static int ac_int_from_sv(struct ac_type *ty, SV *from, UV *magp)
+{
+    dTHX;
+    int neg = 0;
+    NV nv;
+
+    SvGETMAGIC(from);
+
+    /* a string used as a number has numeric flags whatever it holds */
+    if (SvPOKp(from) && !SvROK(from) && !looks_like_number(from))
+        croak("\"%" SVf "\" is not an integer", SVfARG(from));
+
+    if (SvIOKp(from) && !SvNOKp(from))
+    {
+        if (SvIsUV(from))
+        {
+            *magp = SvUVX(from);
+            return 0;
+        }
+
+        neg = SvIVX(from) < 0;
+        *magp = neg ? (UV) -(SvIVX(from) + 1) + 1 : (UV) SvIVX(from);
+        return neg;
+    }
+
+    if (SvPOKp(from) && !SvNIOKp(from) && !SvROK(from))
+    {
+        STRLEN len;
+        const char *pv = SvPV_nomg(from, len);
+        int flags = grok_number(pv, len, magp);
+
+        if ((flags & IS_NUMBER_IN_UV) && !(flags & IS_NUMBER_NOT_INT))
+            return (flags & IS_NUMBER_NEG) != 0;
+    }
+    else if (!SvNIOKp(from) || SvROK(from))
+    {
+        croak("%s is not an integer",
+                SvOK(from) ? form("\"%" SVf "\"", SVfARG(from)) : "undef");
+    }
+
+    nv = SvNV_nomg(from);
+
+    if (nv != nv || Perl_floor(nv) != nv)
+        croak("%" NVgf " is not an integer", nv);
+
+    neg = nv < 0;
+
+    if ((neg ? -nv : nv) >= (NV) UV_MAX)
+        ac_int_range_croak(ty, form("%" NVgf, nv));
+
+    *magp = (UV) (neg ? -nv : nv);
+    return neg;
+}
+
+static void ac_int_get(struct ac_type *ty, ac_object obj, UV bit_in_obj,
+        SV *ret)
+{
+    dTHX;
+
+    sv_setiv(ret, ac_object_fetch_signed(obj, bit_in_obj, ty->inline_size));
+}
+
+static void ac_int_store(struct ac_type *ty, ac_object obj, UV bit_in_obj,
+        IV val)
+{
+    ac_object_store(obj, bit_in_obj, ty->inline_size, (UV) val &
+            ac_uint_max(ty));
+}
+
+static IV ac_int_value(struct ac_type *ty, SV *from)
+{
+    dTHX;
+    UV mag;
+    int neg = ac_int_from_sv(ty, from, &mag);
+
+    if (mag > (UV) ac_int_max(ty) + neg)
+        ac_int_range_croak(ty, SvPV_nolen(from));
+
+    return neg ? -(IV) (mag - 1) - 1 : (IV) mag;
+}
+
+static void ac_int_put(struct ac_type *ty, ac_object obj, UV bit_in_obj,
+        SV *from)
+{
+    ac_int_store(ty, obj, bit_in_obj, ac_int_value(ty, from));
+}
+
+static void ac_int_normalize(struct ac_type *ty, SV *from, SV *to)
+{
+    dTHX;
+
+    sv_setiv(to, ac_int_value(ty, from));
+}
+
+static void ac_int_parse(struct ac_type *ty, ac_object obj, UV bit_in_obj,
+        const char *pv, STRLEN len)
+{
+    UV mag;
+    int neg = ac_int_parse_text(ty, pv, len, (UV) ac_int_max(ty) + 1, &mag);
+
+    if (!neg && mag > (UV) ac_int_max(ty))
+        ac_int_range_croak(ty, form("\"%.*s\"", (int) len, pv));
+
+    ac_int_store(ty, obj, bit_in_obj, neg ? -(IV) (mag - 1) - 1 : (IV) mag);
+}
+
+static void ac_int_deparse(struct ac_type *ty, SV *strbuf)
+{
+    dTHX;
+
+    sv_catpvf(strbuf, "int%d", (int) ty->inline_size);
+}
+
+static void ac_uint_get(struct ac_type *ty, ac_object obj, UV bit_in_obj,
+        SV *ret)
+{
+    dTHX;
+
+    sv_setuv(ret, ac_object_fetch(obj, bit_in_obj, ty->inline_size));
+}
+
+static UV ac_uint_value(struct ac_type *ty, SV *from)
+{
+    dTHX;
+    UV mag;
+
+    if ((ac_int_from_sv(ty, from, &mag) && mag) || mag > ac_uint_max(ty))
+        ac_int_range_croak(ty, SvPV_nolen(from));
+
+    return mag;
+}
+
+static void ac_uint_put(struct ac_type *ty, ac_object obj, UV bit_in_obj,
+        SV *from)
+{
+    ac_object_store(obj, bit_in_obj, ty->inline_size,
+            ac_uint_value(ty, from));
+}
+
+static void ac_uint_normalize(struct ac_type *ty, SV *from, SV *to)
+{
+    dTHX;
+
+    sv_setuv(to, ac_uint_value(ty, from));
+}
+
+static void ac_uint_parse(struct ac_type *ty, ac_object obj, UV bit_in_obj,
+        const char *pv, STRLEN len)
+{
+    UV mag;
+
+    if (ac_int_parse_text(ty, pv, len, ac_uint_max(ty), &mag) && mag)
+        ac_int_range_croak(ty, form("\"%.*s\"", (int) len, pv));
+
+    ac_object_store(obj, bit_in_obj, ty->inline_size, mag);
+}
+
+static void ac_uint_deparse(struct ac_type *ty, SV *strbuf)
+{
+    dTHX;
+
+    sv_catpvf(strbuf, "uint%d", (int) ty->inline_size);
+}
+
+static void ac_int_free_type(struct ac_type *ty)
+{
+    Safefree(ty);
+}
+
+static struct ac_type_ops ac_int_ops = {
+    NULL, /* subobject */
+    NULL, /* subobject_exists */
+    NULL, /* subobject_add */
+    NULL, /* subobject_delete */
+    ac_int_get,
+    ac_int_put,
+    ac_int_parse,
+    ac_int_normalize,
+    NULL, /* initialize */
+    NULL, /* destroy */
+    NULL, /* translocate */
+    NULL, /* postcompact */
+    NULL, /* mark */
+    NULL, /* forwardize */
+    ac_int_deparse,
+    ac_int_free_type
+};
+
+static struct ac_type_ops ac_uint_ops = {
+    NULL, /* subobject */
+    NULL, /* subobject_exists */
+    NULL, /* subobject_add */
+    NULL, /* subobject_delete */
+    ac_uint_get,
+    ac_uint_put,
+    ac_uint_parse,
+    ac_uint_normalize,
+    NULL, /* initialize */
+    NULL, /* destroy */
+    NULL, /* translocate */
+    NULL, /* postcompact */
+    NULL, /* mark */
+    NULL, /* forwardize */
+    ac_uint_deparse,
+    ac_int_free_type
+};
+
+/*
+ * Like the SV type, each integer type is made once and kept forever; there
+ * are only so many of them.  Indexed by signedness, then bits.
+ */
+static struct ac_type *ac_int_types[2][AC_UV_BITS + 1];
+
+static struct ac_type *ac_make_integral_type(struct ac_type_ops *ops,
+        int bits)
+{
+    struct ac_type **typ;
+
+    if (bits < 1 || bits > (int) AC_UV_BITS)
+        croak("Integer types must have between 1 and %d bits",
+                (int) AC_UV_BITS);
+
+    typ = &ac_int_types[ops == &ac_uint_ops][bits];
+
+    if (!*typ)
+    {
+        Newxz(*typ, 1, struct ac_type);
+        ac_init_type(*typ, ops, bits, 0);
+    }
+
+    SvREFCNT_inc((*typ)->reflection);
+    return *typ;
+}
+
+struct ac_type *ac_make_int_type(int bits)
+{
+    return ac_make_integral_type(&ac_int_ops, bits);
+}
+
+struct ac_type *ac_make_uint_type(int bits)
+{
+    return ac_make_integral_type(&ac_uint_ops, bits);
+}
+
+struct ac_type *ac_make_iv_type(void)
+{
+    return ac_make_int_type(AC_UV_BITS);
+}
+
+struct ac_type *ac_make_uv_type(void)
+{
+    return ac_make_uint_type(AC_UV_BITS);
+}
+
+struct ac_type *ac_make_type_named(pTHX_ const char *name)
+{
+    const char *digits;
+    char *end;
+    long bits;
+
+    if (strEQ(name, "sv"))
+        return ac_make_sv_type();
+    if (strEQ(name, "iv"))
+        return ac_make_iv_type();
+    if (strEQ(name, "uv"))
+        return ac_make_uv_type();
+
+    digits = strnEQ(name, "int", 3) ? name + 3 :
+        strnEQ(name, "uint", 4) ? name + 4 : NULL;
+
+    if (digits && isDIGIT(*digits))
+    {
+        bits = strtol(digits, &end, 10);
+
+        if (!*end)
+            return *name == 'u' ? ac_make_uint_type(bits) :
+                ac_make_int_type(bits);
+    }
+
+    croak("Unknown type \"%s\"", name);
+}
@@ -1,6 +1,7 @@
-#include <EXTEND.h>
+#include <EXTERN.h>
 #include <perl.h>
 
+#include "handle.h"
 #include "Compact.h"
 
 /*
@@ -28,12 +29,19 @@
  * fragmentation, we put pages into an ordered sequence, and allow objects to
  * span pages.  This means that object storage is OFTEN DISCONTIGUOUS.
  *
+ * A class may also have a cold segment, a second sequence of pages indexed by
+ * the same object number, with its own per-object size.  Record types put
+ * rarely used fields there; offsets into it are flagged with AC_COLD_BIT.
+ *
  * TODO: This module isn't global destruction clean either.
  *
  * TODO: Abstract the allocation logic and make it threadsafe.
  */
 
 #define AC_PAGE_BYTES 4096
+#define AC_PAGE_BITS (AC_PAGE_BYTES * CHAR_BIT)
+#define AC_U8_BIT 8
+#define AC_U32_BIT 32
 
 union ac_page {
     union ac_page *next;
@@ -65,12 +73,13 @@ static union ac_page *ac_get_free_page()
 
     ret = free_page;
     free_page = ret->next;
-    return free_page;
+    Zero(ret, 1, union ac_page);
+    return ret;
 }
 
-static void ac_delete_class(void *clp);
+static void ac_delete_class(pTHX_ void *clp);
 
-AC_DEFINE_HANDLE_SORT(class, 0, ac_delete_class, 0);
+AC_DEFINE_HANDLE_SORT(hs_class, 0, ac_delete_class);
 
 int ac_param_pointer_size = 32;
 
@@ -80,15 +89,16 @@ int ac_param_pointer_size = 32;
 struct ac_class *ac_new_class(struct ac_type *ty, UV nbits, int lifetime,
         SV *metaclass, HV *stash)
 {
+    dTHX;
     struct ac_class *n;
 
     Newxz(n, 1, struct ac_class);
 
     n->dtype = ty;
     SvREFCNT_inc(ty->reflection);
-    n->reflection = ac_rehandle(&ac_hs_class, n);
+    n->reflection = ac_rehandle(aTHX_ &ac_hs_class, n);
     n->stash = stash;
-    SvREFCNT_int((SV*)stash);
+    SvREFCNT_inc((SV*)stash);
     n->metaclass = metaclass;
     SvREFCNT_inc((SV*)metaclass);
     n->lifetime = lifetime;
@@ -100,7 +110,7 @@ struct ac_class *ac_new_class(struct ac_type *ty, UV nbits, int lifetime,
     n->obj_size_bits = nbits + n->obj_overhead_bits;
 
     /* Leave room for the freelist pointer */
-    if (n->obj_size_bits < ac_param_pointer_size)
+    if (n->obj_size_bits < (UV) ac_param_pointer_size)
         n->obj_size_bits = ac_param_pointer_size;
 
     /* Prevent object count from reaching UV_MAX */
@@ -109,6 +119,8 @@ struct ac_class *ac_new_class(struct ac_type *ty, UV nbits, int lifetime,
 
     AC_OVERFLOW_CHECK(n->obj_size_bits, n->obj_overhead_bits);
 
+    n->cold_size_bits = ty->cold_size;
+
     return n;
 }
 
@@ -123,12 +135,88 @@ struct ac_dirent
 
 /* entry 0 is an unallocated sentinel */
 static struct ac_dirent *directory;
+static UV dirsize = 0;
 static UV dirfree = 0;
 
-void ac_delete_class(void *clp)
+struct ac_class *ac_class_of(ac_object o)
+{
+    return directory[o >> DIRENT_SHIFT].cl;
+}
+
+struct ac_class *ac_class_unhandle(pTHX_ SV *ref)
+{
+    if (!SvROK(ref))
+        croak("class handle must be a reference");
+
+    return (struct ac_class *) ac_unhandle(aTHX_ &ac_hs_class, SvRV(ref),
+            NULL, "class handle has incorrect magic");
+}
+
+/* Find the bit address of (o, bitoff), and the page array it is in. */
+static UV ac_locate(ac_object o, UV bitoff, union ac_page ***pagesp)
+{
+    struct ac_dirent *de = &directory[o >> DIRENT_SHIFT];
+    struct ac_class *cl = de->cl;
+    UV ix = de->objnum + (o & (OBJS_PER_DIRENT - 1));
+
+    if (AC_IS_COLD(bitoff))
+    {
+        *pagesp = cl->cold_pages;
+        return ix * cl->cold_size_bits + (bitoff & ~AC_COLD_BIT);
+    }
+
+    *pagesp = cl->data_pages;
+    return ix * cl->obj_size_bits + cl->obj_overhead_bits + bitoff;
+}
+
+static unsigned char *ac_bit_byte(union ac_page **pages, UV pos)
+{
+    return (unsigned char *)pages[pos / AC_PAGE_BITS]->payload +
+        (pos % AC_PAGE_BITS) / CHAR_BIT;
+}
+
+static ac_object ac_index_to_object(struct ac_class *cl, UV ix)
+{
+    return ((ac_object)cl->dirents[ix >> DIRENT_SHIFT] << DIRENT_SHIFT) |
+        (ix & (OBJS_PER_DIRENT - 1));
+}
+
+static void ac_add_dirent(struct ac_class *cl)
+{
+    UV de;
+
+    if (dirfree)
+    {
+        de = dirfree;
+        dirfree = directory[de].objnum;
+    }
+    else
+    {
+        if (!dirsize)
+            dirsize = 1; /* the sentinel */
+
+        Renew(directory, dirsize + 1, struct ac_dirent);
+        de = dirsize++;
+    }
+
+    if (cl->num_dirents == cl->dirent_ary_size)
+    {
+        cl->dirent_ary_size = cl->dirent_ary_size ?
+            cl->dirent_ary_size * 2 : 4;
+        Renew(cl->dirents, cl->dirent_ary_size, int);
+    }
+
+    directory[de].cl = cl;
+    directory[de].objnum = cl->num_dirents * OBJS_PER_DIRENT;
+    cl->dirents[cl->num_dirents++] = de;
+}
+
+void ac_delete_class(pTHX_ void *clp)
 {
-    struct ac_class *cl = (struct ac_class *) cl;
-    int ix;
+    struct ac_class *cl = (struct ac_class *) clp;
+    UV ix;
+
+    ac_profile_forget(cl);
 
     SvREFCNT_dec(cl->dtype->reflection);
     SvREFCNT_dec(cl->metaclass);
@@ -137,27 +225,90 @@ void ac_delete_class(void *clp)
     for (ix = 0; ix < cl->num_data_pages; ix++)
         ac_push_free_page(cl->data_pages[ix]);
 
-    for (ix = 0; ix < cl->num_dirents; ix++)
+    for (ix = 0; ix < cl->num_cold_pages; ix++)
+        ac_push_free_page(cl->cold_pages[ix]);
+
+    for (ix = 0; ix < (UV) cl->num_dirents; ix++)
     {
         directory[cl->dirents[ix]].objnum = dirfree;
         dirfree = cl->dirents[ix];
     }
 
     Safefree(cl->data_pages);
+    Safefree(cl->cold_pages);
     Safefree(cl->dirents);
 }
 
+/* The freelist link lives at the very start of the object, overhead and
+   all; ac_new_class guarantees there is room */
 static void ac_push_free_obj(ac_object o) {
     struct ac_class *cl = ac_class_of(o);
 
-    ac_object_store(o, -ac_param_pointer_size,
+    ac_object_store(o, -cl->obj_overhead_bits,
             ac_param_pointer_size, cl->freelist_head);
     cl->freelist_head = o;
 }
 
-static void ac_add_page(struct ac_class *cl) {
-    int old_complete_objects = cl->num_data_pages * AC_PAGE_BITS /
-    union ac_page *np = ac_get_free_page();
+static void ac_add_page(union ac_page ***pages, UV *count, UV *size) {
+    if (*count == *size)
+    {
+        *size = *size ? *size * 2 : 4;
+        Renew(*pages, *size, union ac_page *);
+    }
+
+    (*pages)[(*count)++] = ac_get_free_page();
+}
+
+/*
+ * Add a data page to the class, and put the objects it completes on the
+ * freelist.  The cold segment, if any, grows in step so that every object
+ * number with data storage also has cold storage.
+ */
+static void ac_refill(struct ac_class *cl) {
+    UV first = cl->total_objects;
+    UV ix;
+
+    ac_add_page(&cl->data_pages, &cl->num_data_pages, &cl->dpa_size);
+    cl->total_objects = cl->num_data_pages * AC_PAGE_BITS / cl->obj_size_bits;
+
+    while ((UV) cl->num_dirents * OBJS_PER_DIRENT < cl->total_objects)
+        ac_add_dirent(cl);
+
+    while (cl->num_cold_pages * AC_PAGE_BITS <
+            cl->total_objects * cl->cold_size_bits)
+        ac_add_page(&cl->cold_pages, &cl->num_cold_pages, &cl->cpa_size);
+
+    /* Backwards, so that allocation proceeds in address order */
+    for (ix = cl->total_objects; ix > first; ix--)
+        ac_push_free_obj(ac_index_to_object(cl, ix - 1));
+}
+
+/* Recycled storage is dirty; type initializers expect zeroes. */
+static void ac_zero_object(struct ac_class *cl, ac_object o) {
+    UV chunk = sizeof(UV) * CHAR_BIT;
+    UV bit;
+
+    for (bit = 0; bit < cl->obj_size_bits; bit += chunk)
+        ac_object_store(o, bit - cl->obj_overhead_bits,
+                (cl->obj_size_bits - bit < chunk) ?
+                    cl->obj_size_bits - bit : chunk, 0);
+
+    for (bit = 0; bit < cl->cold_size_bits; bit += chunk)
+        ac_object_store(o, AC_COLD_BIT | bit,
+                (cl->cold_size_bits - bit < chunk) ?
+                    cl->cold_size_bits - bit : chunk, 0);
+}
+
+void ac_release_object(ac_object o) {
+    struct ac_class *cl = ac_class_of(o);
+
+    ac_push_free_obj(o);
+
+    if (!--cl->used_objects)
+    {
+        dTHX;
+        SvREFCNT_dec(cl->reflection);
+    }
 }
 
 static void ac_destroy(ac_object o) {
@@ -166,19 +317,81 @@ static void ac_destroy(ac_object o) {
     if (cl->dtype->flags & AC_DESTROY_USED)
         cl->dtype->ops->destroy(cl->dtype, o, 0);
 
-    ac_push_free_obj(o);
+    ac_release_object(o);
+}
+
+/*
+ * Deferred destruction.  While ac_param_destroy_batch is set, objects
+ * whose handles die are queued instead of destroyed, and the queue is
+ * destroyed all at once when it reaches that size or is flushed, sorted by
+ * class and then object number.  Tearing down a big structure then walks
+ * each class's pages in order rather than hopping about at random.  Queued
+ * objects keep their class alive, as live ones do.
+ *
+ * Destroying can free more handles (the destroy hooks drop SVs, whose
+ * DESTROY methods may do anything), which queue up afresh; the flush goes
+ * round again until nothing is left.
+ */
+int ac_param_destroy_batch = 0;
+
+static ac_object *ac_destroy_queue;
+static UV ac_destroy_queued;
+static UV ac_destroy_queue_size;
+
+static int ac_destroy_cmp(const void *x, const void *y) {
+    ac_object a = *(const ac_object *) x, b = *(const ac_object *) y;
+    struct ac_class *ca = ac_class_of(a), *cb = ac_class_of(b);
+
+    if (ca != cb)
+        return ca < cb ? -1 : 1;
+
+    return a < b ? -1 : a > b;
+}
+
+void ac_flush_destroys(void) {
+    while (ac_destroy_queued)
+    {
+        ac_object *q = ac_destroy_queue;
+        UV n = ac_destroy_queued;
+        UV i;
+
+        ac_destroy_queue = NULL;
+        ac_destroy_queued = ac_destroy_queue_size = 0;
+
+        qsort(q, n, sizeof(ac_object), ac_destroy_cmp);
+
+        for (i = 0; i < n; i++)
+            ac_destroy(q[i]);
+
+        Safefree(q);
+    }
+}
+
+static void ac_queue_destroy(ac_object o) {
+    if (ac_destroy_queued == ac_destroy_queue_size)
+    {
+        ac_destroy_queue_size = ac_destroy_queue_size ?
+            ac_destroy_queue_size * 2 : 64;
+        Renew(ac_destroy_queue, ac_destroy_queue_size, ac_object);
+    }
 
-    cl->used_objects--;
-    SvREFCNT_dec(cl->reflection);
+    ac_destroy_queue[ac_destroy_queued++] = o;
+
+    if (ac_destroy_queued >= (UV) ac_param_destroy_batch)
+        ac_flush_destroys();
 }
 
 /* TODO arrange for DESTROY to be called at predictable times - ideally, only
    when the underlying object is destroyed */
-static void ac_free_handle(ac_object o) {
+void ac_free_handle(pTHX_ void *op) {
+    ac_object o = PTR2UV(op);
     struct ac_class *cl = ac_class_of(o);
 
     if (cl->lifetime == AC_LIFE_PERL) {
-        ac_destroy(o);
+        if (ac_param_destroy_batch > 0 && PL_phase != PERL_PHASE_DESTRUCT)
+            ac_queue_destroy(o);
+        else
+            ac_destroy(o);
     } else {
         ac_unref_object(o);
     }
@@ -191,12 +404,17 @@ ac_object ac_new_object(struct ac_class *cl) {
         ac_refill(cl);
 
     o = cl->freelist_head;
-    cl->freelist_head = INT2PTR(void, ac_object_fetch(o, 0,
-                sizeof(UV) * CHAR_BIT));
-    /* TODO step this down somehow, we want creating 5 billion objects to
-       work */
-    SvREFCNT_inc(cl->reflection);
-    cl->used_objects++;
+    cl->freelist_head = ac_object_fetch(o, -cl->obj_overhead_bits,
+            ac_param_pointer_size);
+    ac_zero_object(cl, o);
+
+    /*
+     * A class's objects hold one reference to it between them, taken by
+     * the first and dropped with the last, so any number of objects can
+     * keep it alive without touching the SV each time.
+     */
+    if (!cl->used_objects++)
+        SvREFCNT_inc(cl->reflection);
 
     switch (cl->lifetime)
     {
@@ -243,7 +461,7 @@ void ac_ref_object(ac_object o) {
             break;
         case AC_LIFE_REF8:
             old = ac_object_fetch(o, -AC_U8_BIT, AC_U8_BIT);
-            if (old) ac_object_store(o, -AC_U8_BIT, AC_8_BIT, old + 1);
+            if (old) ac_object_store(o, -AC_U8_BIT, AC_U8_BIT, old + 1);
             break;
     }
 
@@ -277,6 +495,58 @@ void ac_unref_object(ac_object o) {
         ac_destroy(o);
 }
 
-UV ac_object_fetch(ac_object o, UV bitoff, UV count);
-IV ac_object_fetch_signed(ac_object o, UV bitoff, UV count);
-void ac_object_store(ac_object o, UV bitoff, UV count, UV val);
+/*
+ * Bit at a time would be more honest; byte at a time is what we do, since
+ * fields are free to straddle bytes and pages alike.
+ */
+UV ac_object_fetch(ac_object o, UV bitoff, UV count) {
+    union ac_page **pages;
+    UV pos = ac_locate(o, bitoff, &pages);
+    UV val = 0;
+    UV done = 0;
+
+    while (done < count)
+    {
+        unsigned char *p = ac_bit_byte(pages, pos + done);
+        int shift = (pos + done) % CHAR_BIT;
+        UV take = CHAR_BIT - shift;
+
+        if (take > count - done)
+            take = count - done;
+
+        val |= (UV)((*p >> shift) & ((1U << take) - 1)) << done;
+        done += take;
+    }
+
+    return val;
+}
+
+IV ac_object_fetch_signed(ac_object o, UV bitoff, UV count) {
+    UV raw = ac_object_fetch(o, bitoff, count);
+
+    if (count < sizeof(UV) * CHAR_BIT && (raw >> (count - 1)) & 1)
+        raw |= ~(UV)0 << count;
+
+    return (IV)raw;
+}
+
+void ac_object_store(ac_object o, UV bitoff, UV count, UV val) {
+    union ac_page **pages;
+    UV pos = ac_locate(o, bitoff, &pages);
+    UV done = 0;
+
+    while (done < count)
+    {
+        unsigned char *p = ac_bit_byte(pages, pos + done);
+        int shift = (pos + done) % CHAR_BIT;
+        UV take = CHAR_BIT - shift;
+        unsigned mask;
+
+        if (take > count - done)
+            take = count - done;
+
+        mask = ((1U << take) - 1) << shift;
+        *p = (*p & ~mask) | (((unsigned)(val >> done) << shift) & mask);
+        done += take;
+    }
+}
@@ -0,0 +1,88 @@
+#include <EXTERN.h>
+#include <perl.h>
+
+#include "handle.h"
+#include "Compact.h"
+
+/*
+ * Bookkeeping common to all types.  A type lives exactly as long as its
+ * reflection; classes and containing types keep that alive.
+ */
+
+static void ac_delete_type(pTHX_ void *typ)
+{
+    struct ac_type *ty = (struct ac_type *) typ;
+
+    ty->ops->free_type(ty);
+}
+
+AC_DEFINE_HANDLE_SORT(hs_type, 0, ac_delete_type);
+
+void ac_init_type(struct ac_type *ty, struct ac_type_ops *ops, UV size,
+        unsigned int flags)
+{
+    dTHX;
+
+    ty->ops = ops;
+    ty->inline_size = size;
+    ty->flags = flags;
+    ty->cold_size = 0;
+    ty->reflection = ac_rehandle(aTHX_ &ac_hs_type, ty);
+}
+
+void ac_do_subobject(struct ac_type **typ, ac_object *op, UV *offp,
+        SV *selector)
+{
+    struct ac_type *ty = *typ;
+
+    if (!ty->ops->subobject)
+        croak("Cannot select a subobject of a scalar");
+
+    ty->ops->subobject(ty, *op, *offp, selector, op, offp, typ);
+}
+
+void ac_do_set(struct ac_type *ty, ac_object o, UV off, SV *val)
+{
+    if (!ty->ops->scalar_put)
+        croak("Cannot assign to an aggregate");
+
+    if (ac_param_profile)
+        ac_profile_count(o, off, 1);
+
+    ty->ops->scalar_put(ty, o, off, val);
+}
+
+void ac_do_get(struct ac_type *ty, ac_object o, UV off, SV *ret)
+{
+    if (!ty->ops->scalar_get)
+        croak("Cannot fetch an aggregate as a scalar");
+
+    if (ac_param_profile)
+        ac_profile_count(o, off, 0);
+
+    ty->ops->scalar_get(ty, o, off, ret);
+}
+
+int ac_child_exists(struct ac_type *ty, ac_object o, UV off, SV *sel)
+{
+    if (!ty->ops->subobject_exists)
+        return 0;
+
+    return ty->ops->subobject_exists(ty, o, off, sel);
+}
+
+void ac_child_add(struct ac_type *ty, ac_object o, UV off, SV *sel)
+{
+    if (!ty->ops->subobject_add)
+        croak("Cannot add subobjects to this type");
+
+    ty->ops->subobject_add(ty, o, off, sel);
+}
+
+void ac_child_delete(struct ac_type *ty, ac_object o, UV off, SV *sel)
+{
+    if (!ty->ops->subobject_delete)
+        croak("Cannot delete subobjects from this type");
+
+    ty->ops->subobject_delete(ty, o, off, sel);
+}
@@ -1,8 +1,9 @@
 use strict;
 use warnings;
 
-use Test::More tests => 25;
-use Scalar::Util 'refaddr';
+use Test::More tests => 30;
+use Scalar::Util qw/refaddr weaken/;
+use B ();
 use Test::Exception;
 
 use Arena::Compact -all => { -prefix => 'b' };
@@ -50,3 +51,14 @@ lives_ok { bdelete($obj2, $kx) } "deleting fields works";
 
 ok(not(bexists($obj2, $kx)), "second no longer has x");
 ok(bexists($obj2, $ky), "second still has y");
+
+# Weakening a reference puts backreference magic ahead of the handle's own;
+# the first lookup moves ours back to the front
+sub magic_order { join ',', map { $_->TYPE } B::svref_2object($_[0])->MAGIC }
+my $weak = $obj2;
+weaken($weak);
+is(magic_order($obj2), '<,~', "weakening puts backreferences first");
+lives_ok { bput($weak, $kx, 56) } "the weak reference still works";
+is(magic_order($obj2), '~,<', "and the handle's magic is at the front again");
+is(join(',', map { bget($weak, $kx) } 1 .. 3), '56,56,56', "used repeatedly");
+is(bget($obj2, $ky), 45.0, "through either reference");
@@ -1,7 +1,7 @@
 use strict;
 use warnings;
 
-use Test::More tests => 14;
+use Test::More tests => 18;
 use Scalar::Util 'refaddr';
 use Test::Exception;
 
@@ -32,3 +32,11 @@ lives_ok { undef $k3 } "deleted last name of first key";
 lives_ok { $k3 = bkey("B"); } "another name for second key";
 is(refaddr $k3, $rak2, "and still the same");
 
+my $kd = bkey("D", 'uint8');
+is(refaddr bkey("D", 'uint8'), refaddr $kd, "same type, same key");
+throws_ok { bkey("D", 'int8') } qr/already exists with type uint8/,
+    "a different type is refused";
+undef $kd;
+lives_ok { $kd = bkey("D", 'int8') } "but not once the key has gone";
+throws_ok { bkey("D", 'uint8') } qr/already exists with type int8/,
+    "and the new key has the new type";
@@ -0,0 +1,52 @@
+use strict;
+use warnings;
+
+use Test::More tests => 13;
+use Test::Exception;
+
+use Arena::Compact -all => { -prefix => 'b' };
+
+my ($ka, $kb, $kc) = map { bkey($_) } qw/a b c/;
+
+my $n1 = bnew();
+my $n2 = bnew();
+
+bput($n1, $ka, 1); bput($n1, $kb, 2); bput($n1, $kc, 3);
+bput($n2, $kc, 30); bput($n2, $ka, 10); bput($n2, $kb, 20);
+
+is(join(',', map { bget($n1, $_) } $ka, $kb, $kc), '1,2,3',
+    "fields survive transitions in one order");
+is(join(',', map { bget($n2, $_) } $ka, $kb, $kc), '10,20,30',
+    "and in another");
+
+lives_ok { bdelete($n1, $kb) } "removed a middle key";
+ok(!bexists($n1, $kb), "it is gone");
+is(bget($n1, $ka) . bget($n1, $kc), '13', "its neighbours are not");
+
+lives_ok { bput($n1, $kb, 4) } "put it back";
+is(join(',', map { bget($n1, $_) } $ka, $kb, $kc), '1,4,3',
+    "values after re-adding");
+
+my @many = map { my $n = bnew(); bput($n, $ka, $_); bput($n, $kb, -$_); $n }
+    1 .. 1000;
+is((grep { bget($many[$_ - 1], $ka) != $_ || bget($many[$_ - 1], $kb) != -$_ }
+    1 .. 1000), 0, "a thousand nodes down a cached path");
+
+lives_ok { @many = () } "and freeing them";
+
+my $n3 = bnew();
+bput($n3, $ka, 1);
+bput($n3, $kb, 2);
+for my $i (1 .. 100) { bdelete($n3, $ka); bput($n3, $ka, $i); }
+is(bget($n3, $ka) . bget($n3, $kb), '1002', "deleting and re-adding in place");
+bdelete($n3, $ka);
+throws_ok { bget($n3, $ka) } qr/not found/, "a deleted field is not found";
+
+my ($nul1, $nul2) = map { bkey("x\0$_") } 1, 2;
+my $n4 = bnew();
+bput($n4, $nul1, 'one');
+bput($n4, $nul2, 'two');
+is(bget($n4, $nul1) . bget($n4, $nul2), 'onetwo',
+    "names differing after a NUL are different fields");
+is_deeply([ sort keys %{ Arena::Compact::layout(bclass_of($n4)) } ],
+    [ map { "x\0$_" } 1, 2 ], "and keep their whole names");
@@ -0,0 +1,72 @@
+use strict;
+use warnings;
+
+use Test::More tests => 13;
+use Test::Exception;
+
+use Arena::Compact -all => { -prefix => 'b' };
+
+# Enough optional keys that most end up sparse rather than as shapes
+my @keys = map { bkey("opt$_") } 0 .. 39;
+my (@nodes, @want);
+
+for my $i (0 .. 499) {
+    my $n = bnew();
+    my %w;
+
+    for my $j (grep { ($i * 7 + $_ * 13) % 11 == 0 } 0 .. 39) {
+        bput($n, $keys[$j], "$i:$j");
+        $w{$j} = "$i:$j";
+    }
+
+    push @nodes, $n;
+    push @want, \%w;
+}
+
+my $bad = 0;
+for my $i (0 .. 499) {
+    for my $j (0 .. 39) {
+        my $has = bexists($nodes[$i], $keys[$j]) ? 1 : 0;
+        $bad++ if $has != exists $want[$i]{$j};
+        $bad++ if $has && bget($nodes[$i], $keys[$j]) ne $want[$i]{$j};
+    }
+}
+is($bad, 0, "optional keys read back correctly");
+
+my $n = $nodes[0];
+my ($j) = sort { $a <=> $b } keys %{ $want[0] };
+lives_ok { bdelete($n, $keys[$j]) } "deleted an optional key";
+ok(!bexists($n, $keys[$j]), "it is gone");
+
+lives_ok { bput($n, bkey('late'), 'x') } "a later key moves the node";
+is(join(',', map { bget($n, $keys[$_]) } grep { $_ != $j }
+        sort { $a <=> $b } keys %{ $want[0] }),
+    join(',', map { $want[0]{$_} } grep { $_ != $j }
+        sort { $a <=> $b } keys %{ $want[0] }),
+    "and its optional keys move with it");
+
+# The root has many children by now, so typed keys put here go sparse and
+# must still be checked against their type
+my $small = bkey('small', 'uint8');
+my $t = bnew();
+bput($t, $small, 200);
+is(bget($t, $small), 200, "a sparse uint8 reads back");
+throws_ok { bput($t, $small, 1000) } qr/out of range for uint8/,
+    "a sparse uint8 refuses a large value";
+throws_ok { bput($t, $small, 'hello') } qr/"hello" is not an integer/,
+    "and a non-number";
+is(bget($t, $small), 200, "which left it alone");
+
+my $u = bnew();
+throws_ok { bput_many($u, $small, -1) } qr/out of range for uint8/,
+    "put_many checks sparse values too";
+bput_many($u, $small, '7');
+cmp_ok(bget($u, $small), '==', 7, "and stores them as the type would");
+
+# A key first used sparse has its type settled as much as any other
+my $loose = bkey('loose');
+bput(bnew(), $loose, 'anything');
+throws_ok { bkey('loose', 'uint8') } qr/already exists with type/,
+    "a key used in a side table cannot be given a type";
+my $late = bkey('late_typed');
+lives_ok { bkey('late_typed', 'uint8') } "an unused one still can";
@@ -0,0 +1,40 @@
+use strict;
+use warnings;
+
+use Test::More tests => 10;
+use Test::Exception;
+
+use Arena::Compact -all => { -prefix => 'b' };
+
+my @k = map { bkey("f$_") } 0 .. 11;
+
+my $n1 = bnew();
+bput_many($n1, map { ($k[$_], $_ * 2) } 0 .. 11);
+is(join(',', map { bget($n1, $_) } @k), join(',', map { $_ * 2 } 0 .. 11),
+    "a dozen fields in one go");
+
+my $n2 = bnew();
+bput($n2, $k[$_], $_) for 0 .. 11;
+bput_many($n2, $k[3] => 'x', $k[0] => 'y');
+is(join(',', map { bget($n2, $_) } @k[0 .. 4]), 'y,1,2,x,4',
+    "overwriting existing fields");
+
+my $n3 = bnew();
+bput($n3, $k[5], 5);
+bput_many($n3, $k[1] => 1, $k[1] => 11, $k[2] => 2);
+is(join(',', map { bget($n3, $_) } @k[1, 2, 5]), '11,2,5',
+    "later pairs win, old fields kept");
+
+throws_ok { bput_many($n3, $k[1]) } qr/Usage/, "odd argument list";
+throws_ok { bput_many($n3, $k[1] => 1, 'f2' => 2) } qr/key handle/,
+    "bad key";
+is(bget($n3, $k[1]), 11, "which changed nothing");
+
+my $small = bkey('small', 'uint8');
+my $n4 = bnew();
+bput($n4, $k[0], 'a');
+throws_ok { bput_many($n4, $k[0] => 'b', $k[6] => 6, $small => 1000) }
+    qr/out of range for uint8/, "a bad value late in the list";
+is(bget($n4, $k[0]), 'a', "left earlier fields alone");
+ok(!bexists($n4, $k[6]), "and added none");
+ok(!bexists($n4, $small), "nor the bad one");
@@ -0,0 +1,47 @@
+use strict;
+use warnings;
+
+use Test::More tests => 11;
+use Test::Exception;
+use Scalar::Util qw/refaddr weaken/;
+
+use Arena::Compact -all => { -prefix => 'b' };
+
+sub class_id { refaddr(bclass_of($_[0])) }
+
+my ($kx, $ky, $kz) = map { bkey($_) } qw/x y z/;
+
+my $tpl = btemplate($kx, $ky, $kz);
+my $n1 = bnew_from_template($tpl, 1, 2, 3);
+is(join(',', map { bget($n1, $_) } $kx, $ky, $kz), '1,2,3',
+    "fields from a template");
+
+my $n2 = bnew_from_template($tpl, 'a');
+ok(bexists($n2, $kx) && !bexists($n2, $ky), "short value lists");
+lives_ok { bput($n2, $kz, 'c') } "filling in the rest later";
+is(bget($n2, $kz), 'c', "works");
+
+my $n3 = bnew();
+bput($n3, $kx, 7); bput($n3, $ky, 8); bput($n3, $kz, 9);
+is(class_id($n3), class_id($n1), "same class as building by hand");
+my $n4 = bnew();
+bput($n4, $kz, 9); bput($n4, $ky, 8); bput($n4, $kx, 7);
+isnt(class_id($n4), class_id($n1), "but not in another order");
+
+throws_ok { bnew_from_template($tpl, 1 .. 4) } qr/3 keys but 4/,
+    "too many values";
+throws_ok { btemplate($kx, $kx) } qr/twice/, "repeated keys";
+
+my @many = map { bnew_from_template($tpl, $_, -$_) } 1 .. 1000;
+is((grep { bget($many[$_ - 1], $ky) != -$_ } 1 .. 1000), 0,
+    "a thousand nodes from one template");
+
+my $ksmall = bkey('small', 'uint8');
+my $tpl2 = btemplate($kx, $ksmall);
+my $held = {};
+my $watch = $held;
+weaken($watch);
+throws_ok { bnew_from_template($tpl2, $held, 1000) }
+    qr/out of range for uint8/, "a refused value";
+undef $held;
+ok(!defined $watch, "frees the half-made node and what it held");
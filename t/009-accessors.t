@@ -0,0 +1,47 @@
+use strict;
+use warnings;
+
+use Test::More tests => 12;
+use Test::Exception;
+
+use Arena::Compact -all => { -prefix => 'b' };
+
+my ($kx, $ky, $kz) = map { bkey($_) } qw/x y z/;
+
+my $tpl = btemplate($kx, $ky);
+my $x = baccessor($kx, $tpl);
+my $y = baccessor($ky, $tpl);
+
+my $n1 = bnew_from_template($tpl, 1, 2);
+is($x->($n1) . $y->($n1), '12', "getting through accessors");
+$y->($n1, 5);
+is(bget($n1, $ky), 5, "setting through accessors");
+
+bdelete($n1, $kx);
+throws_ok { $x->($n1) } qr/not found/, "an unset field is still not found";
+$x->($n1, 7);
+is(bget($n1, $kx), 7, "setting an unset field");
+
+my $n2 = bnew();
+bput($n2, $ky, 'a');
+$x->($n2, 'b');
+is(bget($n2, $kx) . $y->($n2), 'ba', "on nodes of another class");
+
+my $z = baccessor($kz, $n2);
+$z->($n2, 'c');
+is(bget($n2, $kz), 'c', "for a field the class lacks");
+
+throws_ok { $x->('nope') } qr/node handle/, "on a non-node";
+undef $x;
+is($y->($n1), 5, "freeing one accessor leaves the others");
+
+my $ks = bkey('small', 'uint8');
+my $stpl = btemplate($ks);
+my $s = baccessor($ks, $stpl);
+my $n3 = bnew_from_template($stpl);
+throws_ok { $s->($n3, 1000) } qr/out of range for uint8/,
+    "a refused value through an accessor";
+ok(!bexists($n3, $ks), "leaves an unset field unset");
+$s->($n3, 9);
+throws_ok { $s->($n3, -1) } qr/out of range for uint8/, "and a set one";
+is($s->($n3), 9, "as it was");
@@ -0,0 +1,56 @@
+use strict;
+use warnings;
+
+use Test::More tests => 14;
+use Test::Exception;
+use B ();
+
+use Arena::Compact -all => { -prefix => 'b' };
+
+use constant KX => bkey('x');
+
+sub custom_ops {
+    my $count = 0;
+    my @todo = B::svref_2object(shift)->ROOT;
+    while (my $op = shift @todo) {
+        next if ref($op) eq 'B::NULL';
+        $count++ if $op->name =~ /^ac_/;
+        if ($op->flags & B::OPf_KIDS) {
+            for (my $k = $op->first; $$k; $k = $k->sibling) {
+                push @todo, $k;
+            }
+        }
+    }
+    return $count;
+}
+
+my $n = bnew();
+bput($n, KX, 1);
+bput($n, bkey('y'), 2);
+
+is(bget($n, KX) . bget($n, bkey('y')), '12', "constant keys");
+ok(bexists($n, KX) && !bexists($n, bkey('z')), "exists with constant keys");
+is(custom_ops(sub { bget($_[0], KX) }), 1, "get became a custom op");
+is(custom_ops(sub { bput($_[0], bkey('y'), $_[1]) }), 1,
+    "key('y') folded for put");
+
+my $k = KX;
+is(custom_ops(sub { bget($_[0], $k) }), 0, "variable keys are left alone");
+my @args = ($n, KX);
+is(custom_ops(sub { bget(@args) }), 0, "so are list arguments");
+is(bget(@args), 1, "which still work");
+
+my @r = sub { bput($n, KX, 3) }->();
+is(scalar(@r), 0, "put returns nothing in list context");
+is(scalar(bput($n, KX, 4)), undef, "and undef in scalar context");
+
+throws_ok { bget('nope', KX) } qr/node handle/, "errors from custom ops";
+
+# The key handle's own value is Perl's to write; the ops must not trust it
+my $scribble = KX;
+$$scribble = 12345;
+is(bget($n, KX), 4, "get survives a scribbled key handle");
+lives_ok { bput($n, KX, 5) } "so does put";
+ok(bexists($n, KX), "and exists");
+is(bget(bimport_records([ { x => 1 }, { x => 2 } ])->[1], KX), 2,
+    "as does import_records, which caches key handles");
@@ -0,0 +1,26 @@
+use strict;
+use warnings;
+
+use Test::More tests => 9;
+
+use Arena::Compact -all => { -prefix => 'b' };
+use Arena::Compact::HashView;
+
+my $n = bnew();
+bput($n, bkey('a'), 1);
+
+my $h = Arena::Compact::HashView->new($n);
+is($h->{a}, 1, "fetching an existing field");
+is($h->{nope}, undef, "fetching a missing one");
+
+$h->{b} = 2;
+is(bget($n, bkey('b')), 2, "storing a new field");
+ok(exists $h->{b} && !exists $h->{c}, "exists");
+
+is(join(',', sort keys %$h), 'a,b', "keys");
+is(scalar(%$h), 2, "scalar");
+is(delete $h->{a}, 1, "delete returns the old value");
+ok(!bexists($n, bkey('a')), "and removes the field");
+
+%$h = ();
+ok(!bexists($n, bkey('b')), "clearing");
@@ -0,0 +1,34 @@
+use strict;
+use warnings;
+
+use Test::More tests => 9;
+use Test::Exception;
+use Scalar::Util 'refaddr';
+
+use Arena::Compact -all => { -prefix => 'b' };
+
+sub class_id { refaddr(bclass_of($_[0])) }
+
+my @recs = map { { id => $_, name => "n$_", ($_ % 2 ? (odd => 1) : ()) } }
+    1 .. 500;
+
+my $nodes = bimport_records(\@recs);
+is(scalar(@$nodes), 500, "a node per record");
+is((grep { bget($nodes->[$_ - 1], bkey('id')) != $_ } 1 .. 500), 0,
+    "values copied");
+ok(bexists($nodes->[0], bkey('odd')) && !bexists($nodes->[1], bkey('odd')),
+    "each node has its own fields");
+is(class_id($nodes->[0]), class_id($nodes->[2]), "same keys, same class");
+isnt(class_id($nodes->[0]), class_id($nodes->[1]),
+    "different keys, different class");
+
+my $tpl = btemplate(bkey('id'), bkey('name'));
+$nodes = bimport_records(\@recs, $tpl);
+is(join(',', map { bget($nodes->[0], bkey($_)) } qw/id name odd/), '1,n1,1',
+    "with a template, plus a field it lacks");
+is(class_id($nodes->[1]), class_id(bnew_from_template($tpl, 0, 0)),
+    "records matching the template are in its class");
+
+throws_ok { bimport_records([ {}, 1 ]) } qr/Record 1 is not a hash/,
+    "non-hashes";
+throws_ok { bimport_records({}) } qr/Usage/, "non-arrays";
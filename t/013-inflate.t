@@ -0,0 +1,24 @@
+use strict;
+use warnings;
+
+use Test::More tests => 5;
+use Test::Exception;
+
+use Arena::Compact -all => { -prefix => 'b' };
+
+my $n = bnew();
+bput_many($n, bkey('a') => 1, bkey('b') => 2, bkey('c') => 3);
+bdelete($n, bkey('b'));
+
+is_deeply(binflate($n), { a => 1, c => 3 }, "inflating a node");
+is_deeply(binflate(bnew()), {}, "and an empty one");
+
+my $h = binflate($n);
+$h->{a} = 10;
+is(bget($n, bkey('a')), 1, "the hash is a copy");
+
+my @recs = map { { x => $_, "\x{263a}" => -$_ } } 1 .. 100;
+is_deeply(binflate_many(bimport_records(\@recs)), \@recs,
+    "round trip through import_records");
+
+throws_ok { binflate_many([ $n, 'x' ]) } qr/node handle/, "non-nodes";
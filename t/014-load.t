@@ -0,0 +1,54 @@
+use strict;
+use warnings;
+
+use Test::More tests => 12;
+use Test::Exception;
+
+use Arena::Compact -all => { -prefix => 'b' };
+
+my ($kid, $kname, $kdelta) =
+    (bkey('id', 'uint32'), bkey('name'), bkey('delta', 'int8'));
+
+my $n = bnew();
+bput($n, $kdelta, -128);
+is(bget($n, $kdelta), -128, "packed integer fields");
+throws_ok { bput($n, $kdelta, 128) } qr/out of range for int8/,
+    "range checks";
+throws_ok { bkey('id', 'int32') } qr/already exists with type uint32/,
+    "one type per key";
+throws_ok { bkey('bad', 'int99') } qr/between 1 and/, "bad types";
+
+my $tpl = btemplate($kid, $kname, $kdelta);
+my $csv = <<'CSV';
+id,name,delta
+1,plain,-5
+2,"with, comma",7
+3,"two
+lines",
+4,"say ""hi""",0
+CSV
+
+open my $fh, '<', \$csv or die;
+my $nodes = bload_delimited($fh, $tpl, header => 1);
+is(scalar(@$nodes), 4, "a node per record");
+is(join('|', map { bget($_, $kname) } @$nodes),
+    qq{plain|with, comma|two\nlines|say "hi"}, "quoting");
+is(join(',', map { bget($_, $kdelta) } grep { bexists($_, $kdelta) } @$nodes),
+    '-5,7,0', "integers, with an empty cell left unset");
+
+my $tsv = join '', map { "$_\tn$_\r\n" } 1 .. 20000;
+open $fh, '<', \$tsv or die;
+$nodes = bload_delimited($fh, $tpl, sep => "\t", quote => undef);
+is((grep { bget($nodes->[$_ - 1], $kid) != $_ } 1 .. 20000), 0,
+    "many records across buffer boundaries");
+is(bget($nodes->[-1], $kname), 'n20000', "CRLF line ends");
+
+open $fh, '<', \"1,a,300\n" or die;
+throws_ok { bload_delimited($fh, $tpl) } qr/"300" out of range/,
+    "out of range cells";
+open $fh, '<', \"x,a\n" or die;
+throws_ok { bload_delimited($fh, $tpl) } qr/"x" is not an integer/,
+    "non-integers";
+open $fh, '<', \"1,a,2,3\n" or die;
+throws_ok { bload_delimited($fh, $tpl) } qr/Line 1 has more than 3/,
+    "extra fields";
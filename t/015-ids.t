@@ -0,0 +1,67 @@
+use strict;
+use warnings;
+use Test::More tests => 19;
+use Test::Exception;
+
+use Arena::Compact -all => { -prefix => 'b' };
+
+Arena::Compact::check_ids(1);
+
+my $x = bkey('x');
+my $y = bkey('y');
+
+my $id = bnew_id();
+ok(!bexists_id($id, $x), 'new ID has no fields');
+
+$id = bput_id($id, $x, 10);
+is(bget_id($id, $x), 10, 'put_id then get_id');
+$id = bput_id($id, $y, 'why');
+is(bget_id($id, $y), 'why', 'second field');
+is(bget_id($id, $x), 10, 'first field survives the move');
+
+bdelete_id($id, $y);
+ok(!bexists_id($id, $y), 'delete_id');
+
+my $tpl = btemplate($x, $y);
+my $fixed = bnew_id($tpl);
+is(bput_id($fixed, $x, 1), $fixed, 'template nodes stay put');
+
+# A shared ID must not move
+my $shared = bnew_id();
+bref_id($shared);
+my $z = bkey('z');
+is(bput_id($shared, $z, 5), $shared, 'shared ID does not move');
+is(bget_id($shared, $z), 5, 'field kept out of line');
+my $fresh = bnew_id();
+my $moved = bput_id($fresh, $z, 6);
+isnt($moved, $fresh, 'an unshared ID still moves for that key');
+is(bget_id($moved, $z), 6, 'and has it as a field');
+bunref_id($moved);
+
+my $small = bkey('small', 'uint8');
+bput_id($shared, $small, 200);
+is(bget_id($shared, $small), 200, 'typed field on a shared ID');
+throws_ok { bput_id($shared, $small, 1000) } qr/out of range for uint8/,
+    'is checked against its type';
+is(bget_id($shared, $small), 200, 'and left alone when refused');
+
+bunref_id($shared);
+is(bget_id($shared, $z), 5, 'still alive with one count left');
+bunref_id($shared);
+throws_ok { bget_id($shared, $z) } qr/Invalid node ID/,
+    'destroyed ID refused';
+
+throws_ok { bget_id(12345678, $x) } qr/Invalid node ID/, 'made-up ID refused';
+
+# Packed storage
+my $packed = '';
+$packed .= pack 'J', bput_id(bnew_id(), $x, $_) for 1 .. 100;
+my @ids = unpack 'J*', $packed;
+is(scalar(grep { bget_id($ids[$_ - 1], $x) == $_ } 1 .. 100), 100,
+    'IDs round-trip through a packed string');
+bunref_id($_) for @ids;
+throws_ok { bget_id($ids[0], $x) } qr/Invalid node ID/, 'all destroyed';
+
+my $old = bnew_id();
+my $new = bput_id($old, $x, 1);
+throws_ok { bget_id($old, $x) } qr/Invalid node ID/, 'moved-from ID refused';
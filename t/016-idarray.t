@@ -0,0 +1,50 @@
+use strict;
+use warnings;
+use Test::More tests => 16;
+use Test::Exception;
+
+use Arena::Compact -all => { -prefix => 'b' };
+use Arena::Compact::IdArray;
+
+Arena::Compact::check_ids(1);
+
+my $x = bkey('x');
+my $tpl = btemplate($x);
+my @ids = map { my $id = bnew_id($tpl); bput_id($id, $x, $_); $id } 1 .. 6;
+
+my $arr = Arena::Compact::IdArray->new(reverse @ids);
+isa_ok($arr, 'Arena::Compact::IdArray');
+is($arr->len, 6, 'len');
+is($arr->get(0), $ids[5], 'get');
+is($arr->get(-1), $ids[0], 'negative index');
+ok(!defined $arr->get(6), 'past the end');
+
+$arr->push(@ids[0, 1]);
+$arr->unique;
+is_deeply([ $arr->ids ], [ sort { $a <=> $b } @ids ], 'sort and unique');
+
+my $other = Arena::Compact::IdArray->new(@ids[1, 3, 3, 5]);
+is_deeply([ $arr->intersect($other)->ids ], [ @ids[1, 3, 5] ], 'intersect');
+
+# The arrays keep the nodes alive
+bunref_id($_) for @ids;
+is(bget_id($ids[3], $x), 4, 'node held by arrays survives');
+undef $arr;
+is(bget_id($ids[3], $x), 4, 'still held by the other');
+undef $other;
+throws_ok { bget_id($ids[3], $x) } qr/Invalid node ID/,
+    'gone with the last array';
+
+# Taking IDs out drops the array's counts on them
+my @more = map { my $id = bnew_id($tpl); bput_id($id, $x, $_); $id } 1 .. 3;
+my $arr2 = Arena::Compact::IdArray->new(@more);
+bunref_id($_) for @more;
+is($arr2->pop, $more[2], 'pop returns the last ID');
+is($arr2->len, 2, 'and removes it');
+throws_ok { bget_id($more[2], $x) } qr/Invalid node ID/,
+    'dropping the only count on it';
+$arr2->clear;
+is($arr2->len, 0, 'clear empties the array');
+throws_ok { bget_id($more[0], $x) } qr/Invalid node ID/,
+    'and drops the counts of all it held';
+ok(!defined $arr2->pop, 'pop on an empty array');
@@ -0,0 +1,33 @@
+use strict;
+use warnings;
+use Test::More tests => 5;
+
+use Arena::Compact -all => { -prefix => 'b' };
+
+package Canary;
+my $dead = 0;
+sub new { bless {}, shift }
+sub DESTROY { $dead++ }
+
+package main;
+
+my $k = bkey('canary');
+
+Arena::Compact::destroy_batch(10);
+
+my @nodes = map { my $n = bnew(); bput($n, $k, Canary->new); $n } 1 .. 25;
+splice @nodes, 0, 5;
+is($dead, 0, 'nothing destroyed before the batch fills');
+splice @nodes, 0, 5;
+is($dead, 10, 'a full batch is destroyed');
+
+splice @nodes, 0, 3;
+Arena::Compact::flush();
+is($dead, 13, 'flush destroys the rest');
+
+splice @nodes, 0, 2;
+Arena::Compact::destroy_batch(0);
+is($dead, 15, 'turning batching off flushes');
+
+@nodes = ();
+is($dead, 25, 'and then destruction is immediate');
@@ -0,0 +1,40 @@
+use strict;
+use warnings;
+use Test::More tests => 12;
+use Scalar::Util 'blessed';
+
+use Arena::Compact -all => { -prefix => 'b' };
+
+# Turned on at compile time, so that the code below gets the checks
+BEGIN { Arena::Compact::lazy_bless(1) }
+
+sub Arena::Compact::Node::answer { 42 }
+sub Lazy::Base::question { 'six by nine' }
+@Arena::Compact::Node::ISA = ('Lazy::Base');
+package Arena::Compact::Node { sub ask { $_[0]->SUPER::question } }
+
+my $k = bkey('x');
+
+my $n = bnew();
+ok(!defined blessed($n), 'new handle is not blessed yet');
+bput($n, $k, 1);
+is(bget($n, $k), 1, 'and works as a node');
+is(ref($n), 'Arena::Compact::Node', 'ref blesses it');
+is(blessed($n), 'Arena::Compact::Node', 'for good');
+
+my $m = bnew();
+is($m->answer, 42, 'a method call blesses it');
+my $method = 'answer';
+is(bnew()->$method, 42, 'a dynamic one too');
+
+is(bnew()->Arena::Compact::Node::answer, 42, 'a fully qualified one too');
+my $s = bnew();
+is(Arena::Compact::Node::ask($s), 'six by nine', 'and SUPER:: on it');
+
+my $left = bnew();
+my $other = bnew();
+Arena::Compact::lazy_bless(0);
+is(blessed(bnew()), 'Arena::Compact::Node', 'blessed at once when off');
+ok(!defined blessed($left), 'a handle made while on is still unblessed');
+is(ref($left), 'Arena::Compact::Node', 'ref blesses it after turning off');
+is($other->answer, 42, 'and so does a method call');
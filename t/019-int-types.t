@@ -0,0 +1,67 @@
+use strict;
+use warnings;
+use Test::More tests => 24;
+use Test::Exception;
+
+use Arena::Compact -all => { -prefix => 'b' };
+
+my $n = bnew();
+my ($u64, $i64, $i16, $u32) =
+    (bkey('u64', 'uv'), bkey('i64', 'int64'), bkey('i16', 'int16'),
+     bkey('u32', 'uint32'));
+
+bput($n, $u64, 18446744073709551615);
+is(bget($n, $u64), '18446744073709551615', 'uv holds UV_MAX');
+bput($n, $u64, '18446744073709551614');
+is(bget($n, $u64), '18446744073709551614', 'from a string too');
+throws_ok { bput($n, $u64, -1) } qr/out of range for uint64/,
+    'negative IV refused by uv';
+throws_ok { bput($n, $u64, -2.0) } qr/out of range for uint64/,
+    'negative NV refused by uv';
+throws_ok { bput($n, $u64, 1e30) } qr/out of range for uint64/,
+    'huge NV refused';
+throws_ok { bput($n, $u64, 1.5) } qr/not an integer/, 'fraction refused';
+throws_ok { bput($n, $u64, 'abc') } qr/"abc" is not an integer/,
+    'non-numeric string refused';
+my $s = 'xyz';
+{ no warnings 'numeric'; my $dummy = $s + 0; }
+throws_ok { bput($n, $u64, $s) } qr/"xyz" is not an integer/,
+    'even after numeric use';
+throws_ok { bput($n, $u64, undef) } qr/undef is not an integer/,
+    'undef refused';
+is(bget($n, $u64), '18446744073709551614', 'refused values left it alone');
+
+bput($n, $i64, -9223372036854775808);
+is(bget($n, $i64), '-9223372036854775808', 'int64 holds IV_MIN');
+throws_ok { bput($n, $i64, 9223372036854775808) }
+    qr/out of range for int64/, 'one past IV_MAX refused';
+bput($n, $i64, 2.0);
+is(bget($n, $i64), 2, 'integral NV accepted');
+bput($n, $i64, '4.0');
+is(bget($n, $i64), 4, 'and integral string');
+throws_ok { bput($n, $i64, '4.5') } qr/not an integer/,
+    'but not a fractional one';
+
+bput($n, $i16, -32768);
+is(bget($n, $i16), -32768, 'int16 minimum');
+throws_ok { bput($n, $i16, 32768) } qr/out of range for int16/,
+    'int16 maximum + 1 refused';
+throws_ok { bput($n, $i16, -32769) } qr/out of range for int16/,
+    'int16 minimum - 1 refused';
+
+bput($n, $u32, 4294967295);
+is(bget($n, $u32), 4294967295, 'uint32 maximum');
+throws_ok { bput($n, $u32, 4294967296) } qr/out of range for uint32/,
+    'uint32 maximum + 1 refused';
+
+# A refused put leaves the field as absent as it was
+my $i8 = bkey('i8', 'int8');
+my $m = bnew();
+throws_ok { bput($m, $i8, 1000) } qr/out of range for int8/,
+    'refused on a node without the key';
+ok(!bexists($m, $i8), 'which still lacks it');
+bput($m, $i8, 5);
+bdelete($m, $i8);
+throws_ok { bput($m, $i8, 1000) } qr/out of range for int8/,
+    'refused after a delete';
+ok(!bexists($m, $i8), 'which leaves it deleted');
@@ -0,0 +1,47 @@
+use strict;
+use warnings;
+use Test::More;
+use Scalar::Util 'refaddr';
+
+use Arena::Compact ();
+
+plan skip_all => 'build with AC_TEST_HOOKS=1 to test handle tables'
+    unless defined &Arena::Compact::_canon_handle;
+plan tests => 12;
+
+# A canonical handle sort with nothing behind it, to push the handle table
+# through resizes and deletions
+sub handle { Arena::Compact::_canon_handle($_[0]) }
+sub stats { [ Arena::Compact::_canon_stats() ] }
+sub mismatches {
+    my ($h, @which) = @_;
+    return scalar grep { refaddr(handle($_)) != refaddr($h->[$_]) } @which;
+}
+
+my @h = map { handle($_) } 0 .. 9999;
+is(stats()->[0], 10000, 'ten thousand live handles');
+cmp_ok(stats()->[1], '>=', 10000 / 3 * 4, 'after growing several times');
+is(mismatches(\@h, 0 .. 9999), 0, 'each value finds its own handle again');
+is((grep { Arena::Compact::_canon_value($h[$_]) != $_ } 0 .. 9999), 0,
+    'and each handle its value');
+
+my $size = stats()->[1];
+$#h = 99;
+is(stats()->[0], 100, 'freed handles leave the table');
+cmp_ok(stats()->[1], '<', $size, 'which shrinks');
+is(mismatches(\@h, 0 .. 99), 0, 'the rest are still found');
+
+my $kept = refaddr($h[50]);
+push @h, map { handle($_) } 100 .. 9999;
+is(stats()->[0], 10000, 'values come back');
+is(mismatches(\@h, 0 .. 9999), 0, 'with handles of their own');
+
+handle($_) for 20000 .. 29999;
+is(refaddr($h[50]), $kept, 'churn through tombstones leaves the rest alone');
+
+Arena::Compact::_canon_rehome($h[0], 30000);
+ok(refaddr(handle(30000)) == refaddr($h[0]) && refaddr(handle(0)) !=
+    refaddr($h[0]), 'a rehomed handle is found under its new value only');
+
+@h = ();
+is(stats()->[0], 0, 'all gone');
@@ -0,0 +1,89 @@
+use strict;
+use warnings;
+use Test::More tests => 18;
+
+use Arena::Compact -all => { -prefix => 'b' };
+
+sub layout { Arena::Compact::layout(bclass_of($_[0])) }
+
+# Cold fields: hinted keys go to the cold segment of classes made after
+my ($hot, $rare, $note, $warm) = map { bkey(@$_) } [ hot => 'uint32' ],
+    [ rare => 'uint32' ], [ note => 'sv' ], [ warm => 'sv' ];
+Arena::Compact::hint($_, cold => 1) for $rare, $note;
+my $tpl = btemplate($hot, $rare, $note, $warm);
+my @n = map { bnew_from_template($tpl, $_, $_ + 1, "n$_", "w$_") } 1 .. 5000;
+
+my $l = layout($n[0]);
+ok(!$l->{hot}{cold} && !$l->{warm}{cold}, 'hot fields stay in the object');
+ok($l->{rare}{cold} && $l->{note}{cold}, 'cold fields go to the cold segment');
+isnt($l->{rare}{offset}, $l->{note}{offset}, 'at offsets of their own');
+
+sub intact {
+    my $i = bget($_[0], $hot);
+    bget($_[0], $rare) == $i + 1 && bget($_[0], $note) eq "n$i" &&
+        bget($_[0], $warm) eq "w$i";
+}
+is((grep { !intact($_) } @n), 0, 'values in both segments read back');
+
+bput($n[0], bkey('extra', 'uint8'), 1);
+ok(layout($n[0])->{note}{cold} && intact($n[0]),
+    'and move with the node to a new class');
+
+Arena::Compact::hint($note, cold => 0);
+my $m = bnew();
+bput($m, $_, 1) for $note, $hot;
+ok(!layout($m)->{note}{cold}, 'a hint can be taken back for later classes');
+
+# Field order: word multiples, then powers of two by decreasing size, then
+# the rest; heavier fields first among equals
+my @keys = map { bkey(@$_) } [ a => 'uint8' ], [ b => 'uint64' ],
+    [ f => 'uint24' ], [ c => 'uint16' ], [ d => 'uint32' ], [ e => 'sv' ],
+    [ x => 'uint16' ], [ y => 'uint16' ];
+Arena::Compact::hint($keys[6], weight => 1);
+Arena::Compact::hint($keys[7], weight => 10);
+$l = layout(bnew_from_template(btemplate(@keys)));
+my %at = map { $_ => $l->{$_}{offset} } keys %$l;
+is($at{b}, 0, 'a word-sized field leads, though declared later');
+ok($at{b} < $at{e} && $at{e} < $at{d}, 'words first, in declaration order');
+ok($at{d} < $at{c} && $at{c} < $at{a}, 'then smaller sizes in turn');
+is((grep { $at{$_->[0]} % $_->[1] }
+        [ d => 32 ], [ c => 16 ], [ x => 16 ], [ y => 16 ], [ a => 8 ]), 0,
+    'each naturally aligned');
+ok($at{y} < $at{x} && $at{x} < $at{c} && $at{f} > $at{a},
+    'weights order fields of a size, and odd sizes go last');
+
+# Layout from a profile: the hints weight fields by use and mark the rarely
+# used ones cold
+my ($pa, $pb, $pc) = map { bkey($_, 'uint32') } qw/pa pb pc/;
+my $n = bnew();
+bput($n, $_, 1) for $pa, $pb, $pc;
+
+sub hints { Arena::Compact::layout_hints(bclass_of($_[0])) }
+is((grep { $_->{cold} } @{ hints($n) }), 0, 'no counts, no cold fields');
+
+Arena::Compact::profile(1);
+Arena::Compact::profile_reset();
+bget($n, $pc) for 1 .. 1000;
+bget($n, $pb) for 1 .. 100;
+bget($n, $pa);
+Arena::Compact::profile(0);
+
+my ($entry) = grep { exists $_->{fields}{pa} }
+    @{ Arena::Compact::profile_dump() };
+is($entry->{fields}{pc}{get}, 1000, 'gets are counted');
+ok($entry->{fields}{pa}{cold} && !$entry->{fields}{pb}{cold},
+    'a field used under 1/16 as often as the hottest is marked cold');
+
+my %hint = map { $_->{name} => $_ } @{ hints($n) };
+is_deeply($hint{pc}, { name => 'pc', type => 'uint32', cold => 0,
+        weight => 1000 }, 'the hints are field specs');
+
+# Feed them back: classes made afterwards are laid out by them
+Arena::Compact::hint(bkey($_->{name}), cold => $_->{cold},
+    weight => $_->{weight}) for values %hint;
+$n = bnew();
+bput($n, $_, 1) for $pb, $pa, $pc;
+$l = layout($n);
+ok($l->{pa}{cold}, 'and goes to the cold segment');
+ok(!$l->{pb}{cold} && !$l->{pc}{cold}, 'the others stay');
+ok($l->{pc}{offset} < $l->{pb}{offset}, 'hottest first');